@@ -0,0 +1,202 @@
+#include "BarnesHut.h"
+#include "ForceKernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+BarnesHutSolver::BarnesHutSolver(float opening_angle) :
+    m_opening_angle(opening_angle),
+    m_n(0),
+    m_h(0.0f),
+    m_target_order(CellOrder::Morton)
+{
+}
+
+void BarnesHutSolver::set_opening_angle(float opening_angle) {
+    m_opening_angle = opening_angle;
+}
+
+float BarnesHutSolver::opening_angle() const {
+    return m_opening_angle;
+}
+
+void BarnesHutSolver::set_target_order(CellOrder order) {
+    m_target_order = order;
+    if (m_n > 0) {
+        m_targets.build(m_n, order);
+    }
+}
+
+void BarnesHutSolver::build(int n, float h, const float* rho) {
+    // The tree only depends on the grid layout, so it is rebuilt only when the grid changes
+    if (n != m_n || h != m_h) {
+        build_topology(n, h);
+    }
+
+    update_moments(rho);
+}
+
+void BarnesHutSolver::build_topology(int n, float h) {
+    m_n = n;
+    m_h = h;
+
+    m_nodes.clear();
+    m_nodes.reserve(2 * n * n * n);
+    m_nodes.resize(1);
+    build_node(0, 0, 0, 0, n, n, n);
+    m_targets.build(n, m_target_order);
+}
+
+void BarnesHutSolver::build_node(int index, int x0, int y0, int z0, int x1, int y1, int z1) {
+    Node& node = m_nodes[index];
+    node.lo[0] = x0;
+    node.lo[1] = y0;
+    node.lo[2] = z0;
+    node.hi[0] = x1;
+    node.hi[1] = y1;
+    node.hi[2] = z1;
+    node.size = std::max(x1 - x0, std::max(y1 - y0, z1 - z0)) * m_h;
+    node.first_child = -1;
+    node.child_count = 0;
+    node.cell = -1;
+
+    // A box holding a single cell becomes a leaf
+    if (x1 - x0 == 1 && y1 - y0 == 1 && z1 - z0 == 1) {
+        node.cell = x0 + m_n * y0 + m_n * m_n * z0;
+        return;
+    }
+
+    // Split every dimension longer than one cell in half
+    int xs[3] = { x0, x1 - x0 > 1 ? (x0 + x1) / 2 : x1, x1 };
+    int ys[3] = { y0, y1 - y0 > 1 ? (y0 + y1) / 2 : y1, y1 };
+    int zs[3] = { z0, z1 - z0 > 1 ? (z0 + z1) / 2 : z1, z1 };
+
+    int boxes[8][6];
+    int count = 0;
+    for (int c = 0; c < 8; c++) {
+        int bx = c & 1;
+        int by = (c >> 1) & 1;
+        int bz = (c >> 2) & 1;
+        if (xs[bx] == xs[bx + 1] || ys[by] == ys[by + 1] || zs[bz] == zs[bz + 1]) {
+            continue;
+        }
+
+        boxes[count][0] = xs[bx];
+        boxes[count][1] = ys[by];
+        boxes[count][2] = zs[bz];
+        boxes[count][3] = xs[bx + 1];
+        boxes[count][4] = ys[by + 1];
+        boxes[count][5] = zs[bz + 1];
+        count++;
+    }
+
+    // Children are stored next to each other so a node only needs the first index and a count
+    int first_child = (int)m_nodes.size();
+    node.first_child = first_child;
+    node.child_count = count;
+    m_nodes.resize(first_child + count);
+
+    for (int c = 0; c < count; c++) {
+        build_node(first_child + c, boxes[c][0], boxes[c][1], boxes[c][2], boxes[c][3], boxes[c][4], boxes[c][5]);
+    }
+}
+
+void BarnesHutSolver::update_moments(const float* rho) {
+    // Children always come after their parent, so walking backwards visits every node after its children
+    for (int index = (int)m_nodes.size() - 1; index >= 0; index--) {
+        Node& node = m_nodes[index];
+
+        if (node.cell >= 0) {
+            node.mass = rho[node.cell];
+            node.com[0] = node.lo[0] * m_h;
+            node.com[1] = node.lo[1] * m_h;
+            node.com[2] = node.lo[2] * m_h;
+            continue;
+        }
+
+        float mass = 0.0f;
+        float mx = 0.0f;
+        float my = 0.0f;
+        float mz = 0.0f;
+        for (int c = node.first_child; c < node.first_child + node.child_count; c++) {
+            const Node& child = m_nodes[c];
+            mass += child.mass;
+            mx += child.mass * child.com[0];
+            my += child.mass * child.com[1];
+            mz += child.mass * child.com[2];
+        }
+
+        node.mass = mass;
+        if (mass != 0.0f) {
+            node.com[0] = mx / mass;
+            node.com[1] = my / mass;
+            node.com[2] = mz / mass;
+        }
+        else {
+            // Fall back to the geometric center when the masses cancel out
+            node.com[0] = 0.5f * (node.lo[0] + node.hi[0] - 1) * m_h;
+            node.com[1] = 0.5f * (node.lo[1] + node.hi[1] - 1) * m_h;
+            node.com[2] = 0.5f * (node.lo[2] + node.hi[2] - 1) * m_h;
+        }
+    }
+}
+
+void BarnesHutSolver::compute(VectorField& Fg) const {
+    int cells = m_n * m_n * m_n;
+
+    // The tree is only read here, so cells are spread over the thread pool with a traversal stack per chunk
+    parallel_for(0, cells, [&](int begin, int end) {
+        std::vector<int> stack;
+        stack.reserve(64);
+
+        for (int k = begin; k < end; k++) {
+            int i = m_targets.cell(k);
+            int cx = i % m_n;
+            int cy = (i / m_n) % m_n;
+            int cz = i / (m_n * m_n);
+            float px = cx * m_h;
+            float py = cy * m_h;
+            float pz = cz * m_h;
+
+            float fx = 0.0f;
+            float fy = 0.0f;
+            float fz = 0.0f;
+
+            stack.clear();
+            stack.push_back(0);
+            while (!stack.empty()) {
+                const Node& node = m_nodes[stack.back()];
+                stack.pop_back();
+
+                if (node.cell == i) {
+                    continue;
+                }
+
+                float dx = px - node.com[0];
+                float dy = py - node.com[1];
+                float dz = pz - node.com[2];
+                float r = sqrt(dx * dx + dy * dy + dz * dz);
+
+                // A node far enough away acts as a single mass at its center of mass
+                bool contains_target = cx >= node.lo[0] && cx < node.hi[0] &&
+                    cy >= node.lo[1] && cy < node.hi[1] &&
+                    cz >= node.lo[2] && cz < node.hi[2];
+                if (node.cell >= 0 || (!contains_target && node.size < m_opening_angle * r)) {
+                    if (r > 0.0f) {
+                        float Fg_ij = gravity_kernel(r) * node.mass;
+                        fx += Fg_ij * dx / r;
+                        fy += Fg_ij * dy / r;
+                        fz += Fg_ij * dz / r;
+                    }
+                    continue;
+                }
+
+                for (int c = node.first_child; c < node.first_child + node.child_count; c++) {
+                    stack.push_back(c);
+                }
+            }
+
+            Fg.set(i, fx, fy, fz);
+        }
+    });
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "CellOrder.h"
+#include "FieldStorage.h"
+
+// Barnes-Hut octree gravity solver for the cells of an n*n*n grid.
+// The tree is built over index boxes of the grid, so the topology only depends on n and is reused
+// between steps; build() then only refreshes the mass and center of mass of every node from rho.
+// Target cells are visited in Morton order by default, so consecutive targets open mostly the same nodes and find
+// them in cache.
+class BarnesHutSolver {
+public:
+    explicit BarnesHutSolver(float opening_angle = 0.5f);
+
+    void set_opening_angle(float opening_angle);
+    float opening_angle() const;
+
+    // Order in which compute() visits the target cells; the force field stays row-major either way
+    void set_target_order(CellOrder order);
+
+    // Build the octree from the density of each cell
+    void build(int n, float h, const float* rho);
+
+    // Calculate the gravity force on every cell from the current octree
+    void compute(VectorField& Fg) const;
+
+private:
+    struct Node {
+        float mass;
+        float com[3];
+        float size;       // Edge length of the node box
+        int lo[3];        // First cell of the node box in each dimension
+        int hi[3];        // One past the last cell of the node box in each dimension
+        int first_child;  // Index of the first child node, -1 for leaves
+        int child_count;
+        int cell;         // Cell index of a leaf, -1 for internal nodes
+    };
+
+    void build_topology(int n, float h);
+    void build_node(int index, int x0, int y0, int z0, int x1, int y1, int z1);
+    void update_moments(const float* rho);
+
+    float m_opening_angle;
+    int m_n;
+    float m_h;
+    std::vector<Node> m_nodes;
+    CellOrder m_target_order;
+    CellLayout m_targets;
+};
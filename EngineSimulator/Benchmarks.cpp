@@ -0,0 +1,1479 @@
+#include "Benchmarks.h"
+#include "BarnesHut.h"
+#include "CMBDataset.h"
+#include "CellOrder.h"
+#include "DirectSum.h"
+#include "FastMultipole.h"
+#include "FieldStorage.h"
+#include "FixedCMBDataset.h"
+#include "ForceKernels.h"
+#include "GridConvolution.h"
+#include "Integrator.h"
+#include "KernelTable.h"
+#include "Neighborhood.h"
+#include "PairKernels.h"
+#include "ParticleStore.h"
+#include "ScatterAccumulator.h"
+#include "ShortRange.h"
+#include "ThreadPool.h"
+#include "ParticleMesh.h"
+#include "WeakCouplings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <string>
+
+namespace {
+    typedef std::chrono::high_resolution_clock Clock;
+
+    double elapsed_ms(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    template <typename Row>
+    void measure_error(int cells, const VectorField& F, const VectorField& F_ref, Row& row) {
+        double error_sum = 0.0;
+        double ref_sum = 0.0;
+        float max_error = 0.0f;
+
+        for (int i = 0; i < cells; i++) {
+            float ex = F.x[i] - F_ref.x[i];
+            float ey = F.y[i] - F_ref.y[i];
+            float ez = F.z[i] - F_ref.z[i];
+            float error = sqrt(ex * ex + ey * ey + ez * ez);
+            float ref = sqrt(F_ref.x[i] * F_ref.x[i] + F_ref.y[i] * F_ref.y[i] + F_ref.z[i] * F_ref.z[i]);
+
+            error_sum += (double)error * error;
+            ref_sum += (double)ref * ref;
+            if (ref > 0.0f && error / ref > max_error) {
+                max_error = error / ref;
+            }
+        }
+
+        row.max_relative_error = max_error;
+        row.rms_relative_error = ref_sum > 0.0 ? (float)sqrt(error_sum / ref_sum) : 0.0f;
+    }
+}
+
+void fill_benchmark_density(int n, float h, float* rho) {
+    for (int i = 0; i < n * n * n; i++) {
+        float dx = (i % n - n / 2) * h;
+        float dy = ((i / n) % n - n / 2) * h;
+        float dz = (i / (n * n) - n / 2) * h;
+        float r = sqrt(dx * dx + dy * dy + dz * dz);
+        rho[i] = 18.0f * exp(-r / 10.0f) + 1.0f;
+    }
+}
+
+void fill_benchmark_charge(int n, float* q) {
+    for (int i = 0; i < n * n * n; i++) {
+        q[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+}
+
+std::vector<GravityComparison> compare_gravity_solvers(const std::vector<int>& sizes, float opening_angle, int max_direct_n) {
+    std::vector<GravityComparison> rows;
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int n = sizes[s];
+        int cells = n * n * n;
+        float h = 1.0f;
+        bool has_reference = n <= max_direct_n;
+
+        std::vector<float> rho(cells);
+        VectorField F_ref(has_reference ? cells : 0);
+        VectorField F(cells);
+        fill_benchmark_density(n, h, rho.data());
+
+        double reference_ms = -1.0;
+        if (has_reference) {
+            Clock::time_point start = Clock::now();
+            direct_gravity(n, h, rho.data(), F_ref);
+            reference_ms = elapsed_ms(start);
+        }
+
+        for (int solver = 0; solver < 5; solver++) {
+            GravityComparison row;
+            row.n = n;
+            row.reference_ms = reference_ms;
+            row.max_relative_error = -1.0f;
+            row.rms_relative_error = -1.0f;
+
+            Clock::time_point start = Clock::now();
+            if (solver == 0) {
+                row.solver = "Barnes-Hut";
+                BarnesHutSolver barnes_hut(opening_angle);
+                barnes_hut.build(n, h, rho.data());
+                barnes_hut.compute(F);
+            }
+            else if (solver == 4) {
+                row.solver = "Convolution";
+                GridConvolution convolution;
+                convolution.prepare(n, 3, [h](int di, int dj, int dk, double* value) {
+                    gravity_offset_kernel(di, dj, dk, h, value);
+                });
+                float* streams[3] = { F.x, F.y, F.z };
+                convolution.apply(rho.data(), streams);
+            }
+            else {
+                static const char* names[] = { "PM iso FD", "PM iso FFT", "PM periodic" };
+                row.solver = names[solver - 1];
+                ParticleMeshSolver particle_mesh(solver == 3 ? PoissonBoundary::Periodic : PoissonBoundary::Isolated,
+                    solver == 1 ? GradientMethod::FiniteDifference : GradientMethod::Spectral);
+                particle_mesh.compute(n, h, rho.data(), F);
+            }
+            row.solver_ms = elapsed_ms(start);
+
+            if (has_reference) {
+                measure_error(cells, F, F_ref, row);
+            }
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+void print_gravity_comparison(std::ostream& out, const std::vector<GravityComparison>& rows) {
+    out << std::setw(6) << "n" << std::setw(10) << "cells" << std::setw(14) << "solver"
+        << std::setw(14) << "direct ms" << std::setw(14) << "solver ms" << std::setw(10) << "speedup"
+        << std::setw(14) << "max rel err" << std::setw(14) << "rms rel err" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const GravityComparison& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(10) << row.n * row.n * row.n << std::setw(14) << row.solver
+            << std::fixed << std::setprecision(2);
+
+        if (row.reference_ms < 0.0) {
+            // The brute-force sum was skipped, so only the solver time is known
+            out << std::setw(14) << "-" << std::setw(14) << row.solver_ms << std::setw(10) << "-"
+                << std::setw(14) << "-" << std::setw(14) << "-" << "\n";
+        }
+        else {
+            out << std::setw(14) << row.reference_ms << std::setw(14) << row.solver_ms
+                << std::setw(10) << (row.solver_ms > 0.0 ? row.reference_ms / row.solver_ms : 0.0)
+                << std::scientific << std::setprecision(3)
+                << std::setw(14) << row.max_relative_error << std::setw(14) << row.rms_relative_error << "\n";
+        }
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<MultipoleAccuracy> compare_multipole_orders(int n, const std::vector<int>& orders) {
+    std::vector<MultipoleAccuracy> rows;
+    int cells = n * n * n;
+    float h = 1.0f;
+
+    std::vector<float> rho(cells);
+    std::vector<float> q(cells);
+    fill_benchmark_density(n, h, rho.data());
+    fill_benchmark_charge(n, q.data());
+
+    for (int source = 0; source < 2; source++) {
+        bool charge = source == 1;
+        VectorField F_ref(cells);
+        VectorField F(cells);
+
+        Clock::time_point start = Clock::now();
+        if (charge) {
+            direct_inverse_square(n, h, q.data(), 1.0f, F_ref);
+        }
+        else {
+            direct_gravity(n, h, rho.data(), F_ref);
+        }
+        double reference_ms = elapsed_ms(start);
+
+        for (size_t o = 0; o < orders.size(); o++) {
+            FastMultipoleSolver multipole(orders[o]);
+            if (charge) {
+                multipole.set_kernel(
+                    [](double r) { return 1.0 / r; },
+                    [](double r) { return 1.0 / (r * r); });
+            }
+            else {
+                multipole.set_kernel(
+                    [](double r) { return (double)gravity_potential((float)r); },
+                    [](double r) { return (double)gravity_kernel((float)r); });
+            }
+
+            MultipoleAccuracy row;
+            row.n = n;
+            row.order = orders[o];
+            row.source = charge ? "q" : "rho";
+            row.reference_ms = reference_ms;
+
+            start = Clock::now();
+            if (charge) {
+                multipole.compute(n, h, q.data(), q.data(), 1.0f, F);
+            }
+            else {
+                multipole.compute(n, h, rho.data(), nullptr, 1.0f, F);
+            }
+            row.solver_ms = elapsed_ms(start);
+            row.table_bytes = multipole.table_bytes();
+
+            measure_error(cells, F, F_ref, row);
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+void print_multipole_accuracy(std::ostream& out, const std::vector<MultipoleAccuracy>& rows) {
+    out << std::setw(6) << "n" << std::setw(8) << "order" << std::setw(8) << "source"
+        << std::setw(14) << "direct ms" << std::setw(14) << "fmm ms" << std::setw(12) << "tables MB"
+        << std::setw(14) << "max rel err" << std::setw(14) << "rms rel err" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const MultipoleAccuracy& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(8) << row.order << std::setw(8) << row.source
+            << std::fixed << std::setprecision(2)
+            << std::setw(14) << row.reference_ms << std::setw(14) << row.solver_ms
+            << std::setw(12) << row.table_bytes / (1024.0 * 1024.0)
+            << std::scientific << std::setprecision(3)
+            << std::setw(14) << row.max_relative_error << std::setw(14) << row.rms_relative_error << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+namespace {
+    typedef AlignedArray<float[3]> InterleavedField;
+
+    // The per-cell total of four forces as update_grid needs it, with every component interleaved
+    void sum_interleaved(size_t cells, const InterleavedField* forces, InterleavedField& total) {
+        for (size_t i = 0; i < cells; i++) {
+            for (int c = 0; c < 3; c++) {
+                total[i][c] = forces[0][i][c] + forces[1][i][c] + forces[2][i][c] + forces[3][i][c];
+            }
+        }
+    }
+
+    void sum_soa(size_t cells, const VectorField* forces, VectorField& total) {
+        for (int c = 0; c < 3; c++) {
+            const float* f0 = forces[0].component(c);
+            const float* f1 = forces[1].component(c);
+            const float* f2 = forces[2].component(c);
+            const float* f3 = forces[3].component(c);
+            float* out = total.component(c);
+            for (size_t i = 0; i < cells; i++) {
+                out[i] = f0[i] + f1[i] + f2[i] + f3[i];
+            }
+        }
+    }
+
+    // The x component of the total only, as a pass that needs one direction of the force
+    void sum_x_interleaved(size_t cells, const InterleavedField* forces, float* total) {
+        for (size_t i = 0; i < cells; i++) {
+            total[i] = forces[0][i][0] + forces[1][i][0] + forces[2][i][0] + forces[3][i][0];
+        }
+    }
+
+    void sum_x_soa(size_t cells, const VectorField* forces, float* total) {
+        const float* f0 = forces[0].x;
+        const float* f1 = forces[1].x;
+        const float* f2 = forces[2].x;
+        const float* f3 = forces[3].x;
+        for (size_t i = 0; i < cells; i++) {
+            total[i] = f0[i] + f1[i] + f2[i] + f3[i];
+        }
+    }
+}
+
+std::vector<LayoutBandwidth> compare_field_layouts(const std::vector<int>& sizes, int repeats) {
+    std::vector<LayoutBandwidth> rows;
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int n = sizes[s];
+        size_t cells = (size_t)n * n * n;
+
+        // The same random forces in both layouts
+        InterleavedField interleaved[4];
+        VectorField soa[4];
+        for (int f = 0; f < 4; f++) {
+            interleaved[f].resize(cells);
+            soa[f].resize(cells);
+            for (size_t i = 0; i < cells; i++) {
+                for (int c = 0; c < 3; c++) {
+                    float value = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+                    interleaved[f][i][c] = value;
+                    soa[f].component(c)[i] = value;
+                }
+            }
+        }
+
+        InterleavedField interleaved_total(cells);
+        VectorField soa_total(cells);
+        ScalarField x_total(cells);
+
+        for (int pass = 0; pass < 2; pass++) {
+            bool x_only = pass == 1;
+
+            LayoutBandwidth row;
+            row.n = n;
+            row.pass = x_only ? "x only" : "total force";
+
+            // Warm up both layouts once so the first timed pass does not pay for page faults
+            if (x_only) {
+                sum_x_interleaved(cells, interleaved, x_total);
+                sum_x_soa(cells, soa, x_total);
+            }
+            else {
+                sum_interleaved(cells, interleaved, interleaved_total);
+                sum_soa(cells, soa, soa_total);
+            }
+
+            Clock::time_point start = Clock::now();
+            for (int r = 0; r < repeats; r++) {
+                if (x_only) {
+                    sum_x_interleaved(cells, interleaved, x_total);
+                }
+                else {
+                    sum_interleaved(cells, interleaved, interleaved_total);
+                }
+            }
+            row.interleaved_ms = elapsed_ms(start) / repeats;
+
+            start = Clock::now();
+            for (int r = 0; r < repeats; r++) {
+                if (x_only) {
+                    sum_x_soa(cells, soa, x_total);
+                }
+                else {
+                    sum_soa(cells, soa, soa_total);
+                }
+            }
+            row.soa_ms = elapsed_ms(start) / repeats;
+
+            // Bytes the pass needs: four forces read and one total written, three components or one
+            double bytes = (double)cells * sizeof(float) * (x_only ? 5 : 15);
+            row.interleaved_gbs = row.interleaved_ms > 0.0 ? bytes / (row.interleaved_ms * 1e6) : 0.0;
+            row.soa_gbs = row.soa_ms > 0.0 ? bytes / (row.soa_ms * 1e6) : 0.0;
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+void print_layout_bandwidth(std::ostream& out, const std::vector<LayoutBandwidth>& rows) {
+    out << std::setw(6) << "n" << std::setw(14) << "pass"
+        << std::setw(16) << "interleaved ms" << std::setw(10) << "soa ms" << std::setw(10) << "speedup"
+        << std::setw(18) << "interleaved GB/s" << std::setw(10) << "soa GB/s" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const LayoutBandwidth& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(14) << row.pass
+            << std::fixed << std::setprecision(3)
+            << std::setw(16) << row.interleaved_ms << std::setw(10) << row.soa_ms
+            << std::setw(10) << (row.soa_ms > 0.0 ? row.interleaved_ms / row.soa_ms : 0.0)
+            << std::setprecision(2)
+            << std::setw(18) << row.interleaved_gbs << std::setw(10) << row.soa_gbs << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<PairKernelTiming> compare_pair_kernels(const std::vector<int>& sizes) {
+    std::vector<PairKernelTiming> rows;
+    SimdLevel selected = simd_level();
+    SimdLevel detected = detect_simd_level();
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int n = sizes[s];
+        int cells = n * n * n;
+        float h = 1.0f;
+
+        std::vector<float> rho(cells);
+        std::vector<float> q(cells);
+        fill_benchmark_density(n, h, rho.data());
+        fill_benchmark_charge(n, q.data());
+
+        for (int source = 0; source < 2; source++) {
+            bool charge = source == 1;
+            VectorField F_ref(cells);
+            VectorField F(cells);
+
+            Clock::time_point start = Clock::now();
+            if (charge) {
+                direct_inverse_square(n, h, q.data(), 1.0f, F_ref);
+            }
+            else {
+                direct_gravity(n, h, rho.data(), F_ref);
+            }
+            double reference_ms = elapsed_ms(start);
+
+            for (int level = 0; level <= (int)detected; level++) {
+                set_simd_level((SimdLevel)level);
+
+                for (int symmetric = 0; symmetric < 2; symmetric++) {
+                    PairForceSolver pairs;
+                    pairs.set_kernel(charge ? inverse_square_radial() : gravity_radial());
+                    pairs.set_traversal(symmetric ? PairTraversal::Symmetric : PairTraversal::Full);
+
+                    PairKernelTiming row;
+                    row.n = n;
+                    row.kernel = simd_level_name((SimdLevel)level);
+                    row.traversal = symmetric ? "symmetric" : "full";
+                    row.source = charge ? "q" : "rho";
+                    row.reference_ms = reference_ms;
+
+                    start = Clock::now();
+                    if (charge) {
+                        pairs.compute(n, h, q.data(), q.data(), 1.0f, F);
+                    }
+                    else {
+                        pairs.compute(n, h, rho.data(), nullptr, 1.0f, F);
+                    }
+                    row.kernel_ms = elapsed_ms(start);
+
+                    measure_error(cells, F, F_ref, row);
+                    rows.push_back(row);
+                }
+            }
+        }
+    }
+
+    set_simd_level(selected);
+    return rows;
+}
+
+void print_pair_kernels(std::ostream& out, const std::vector<PairKernelTiming>& rows) {
+    out << std::setw(6) << "n" << std::setw(10) << "kernel" << std::setw(11) << "traversal" << std::setw(8) << "source"
+        << std::setw(14) << "direct ms" << std::setw(14) << "kernel ms" << std::setw(10) << "speedup"
+        << std::setw(14) << "max rel err" << std::setw(14) << "rms rel err" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const PairKernelTiming& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(10) << row.kernel << std::setw(11) << row.traversal << std::setw(8) << row.source
+            << std::fixed << std::setprecision(2)
+            << std::setw(14) << row.reference_ms << std::setw(14) << row.kernel_ms
+            << std::setw(10) << (row.kernel_ms > 0.0 ? row.reference_ms / row.kernel_ms : 0.0)
+            << std::scientific << std::setprecision(3)
+            << std::setw(14) << row.max_relative_error << std::setw(14) << row.rms_relative_error << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<ThreadScaling> compare_thread_scaling(int n, const std::vector<int>& thread_counts) {
+    std::vector<ThreadScaling> rows;
+    int cells = n * n * n;
+    float h = 1.0f;
+
+    std::vector<float> rho(cells);
+    fill_benchmark_density(n, h, rho.data());
+    VectorField F(cells);
+
+    static const char* names[] = { "pair kernels", "Barnes-Hut", "PM iso FFT", "FMM" };
+    for (int pass = 0; pass < 4; pass++) {
+        double first_ms = 0.0;
+        int first_threads = 1;
+
+        for (size_t t = 0; t < thread_counts.size(); t++) {
+            default_thread_pool().resize(thread_counts[t]);
+
+            // Solvers are built outside the timed region, so only the per-step work is measured
+            PairForceSolver pairs;
+            pairs.set_kernel(gravity_radial());
+            BarnesHutSolver barnes_hut;
+            ParticleMeshSolver particle_mesh(PoissonBoundary::Isolated, GradientMethod::Spectral);
+            FastMultipoleSolver multipole;
+            multipole.set_kernel(
+                [](double r) { return (double)gravity_potential((float)r); },
+                [](double r) { return (double)gravity_kernel((float)r); });
+            if (pass == 0) {
+                pairs.compute(n, h, rho.data(), nullptr, 1.0f, F);
+            }
+            else if (pass == 2) {
+                particle_mesh.compute(n, h, rho.data(), F);
+            }
+            else if (pass == 3) {
+                multipole.compute(n, h, rho.data(), nullptr, 1.0f, F);
+            }
+
+            Clock::time_point start = Clock::now();
+            if (pass == 0) {
+                pairs.compute(n, h, rho.data(), nullptr, 1.0f, F);
+            }
+            else if (pass == 1) {
+                barnes_hut.build(n, h, rho.data());
+                barnes_hut.compute(F);
+            }
+            else if (pass == 2) {
+                particle_mesh.compute(n, h, rho.data(), F);
+            }
+            else {
+                multipole.compute(n, h, rho.data(), nullptr, 1.0f, F);
+            }
+
+            ThreadScaling row;
+            row.n = n;
+            row.pass = names[pass];
+            row.threads = default_thread_pool().thread_count();
+            row.ms = elapsed_ms(start);
+            if (t == 0) {
+                first_ms = row.ms;
+                first_threads = row.threads;
+            }
+            row.speedup = row.ms > 0.0 ? first_ms / row.ms : 0.0;
+            row.efficiency = row.speedup * first_threads / row.threads;
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+void print_thread_scaling(std::ostream& out, const std::vector<ThreadScaling>& rows) {
+    out << std::setw(6) << "n" << std::setw(14) << "pass" << std::setw(9) << "threads"
+        << std::setw(12) << "ms" << std::setw(10) << "speedup" << std::setw(12) << "efficiency" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const ThreadScaling& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(14) << row.pass << std::setw(9) << row.threads
+            << std::fixed << std::setprecision(2)
+            << std::setw(12) << row.ms << std::setw(10) << row.speedup << std::setw(12) << row.efficiency << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<ScatterTiming> compare_scatter_schedules(int n, const std::vector<int>& thread_counts) {
+    std::vector<ScatterTiming> rows;
+    int cells = n * n * n;
+    float h = 1.0f;
+
+    std::vector<float> Qw(cells);
+    fill_benchmark_charge(n, Qw.data());
+
+    // Full stencil with the force per unit weak charge at every offset
+    std::vector<StencilOffset> stencil = neighborhood_stencil(weak_cutoff, h);
+    std::vector<float> table(3 * stencil.size());
+    for (size_t s = 0; s < stencil.size(); s++) {
+        double value[3];
+        weak_offset_kernel(stencil[s].di, stencil[s].dj, stencil[s].dk, h, value);
+        for (int c = 0; c < 3; c++) {
+            table[3 * s + c] = (float)value[c];
+        }
+    }
+
+    // Reference: every cell gathers the force of all its neighbors, so nothing is written twice
+    VectorField F_ref(cells);
+    Clock::time_point start = Clock::now();
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                int j = x + n * (y + n * z);
+                for (size_t s = 0; s < stencil.size(); s++) {
+                    int sx = x - stencil[s].di;
+                    int sy = y - stencil[s].dj;
+                    int sz = z - stencil[s].dk;
+                    if (sx < 0 || sx >= n || sy < 0 || sy >= n || sz < 0 || sz >= n) {
+                        continue;
+                    }
+
+                    float coupling = Qw[sx + n * (sy + n * sz)] * Qw[j];
+                    F_ref.add(j, coupling * table[3 * s], coupling * table[3 * s + 1], coupling * table[3 * s + 2]);
+                }
+            }
+        }
+    }
+    double reference_ms = elapsed_ms(start);
+
+    // The half of the stencil the scatter kernels visit, each offset adding to both of its cells
+    std::vector<StencilOffset> half;
+    std::vector<float> half_table;
+    for (size_t s = 0; s < stencil.size(); s++) {
+        const StencilOffset& o = stencil[s];
+        if (o.dk > 0 || (o.dk == 0 && (o.dj > 0 || (o.dj == 0 && o.di > 0)))) {
+            half.push_back(o);
+            half_table.insert(half_table.end(), table.begin() + 3 * s, table.begin() + 3 * s + 3);
+        }
+    }
+    int reach = (int)ceil(weak_cutoff / h);
+    ScatterAccumulator::Kernel kernel = [&](const CellBox& box, VectorField& out) {
+        weak_stencil_forces(n, box, half.data(), half_table.data(), (int)half.size(), Qw.data(), out);
+    };
+
+    static const ScatterSchedule schedules[] = { ScatterSchedule::Privatized, ScatterSchedule::Colored };
+    static const char* names[] = { "privatized", "colored" };
+    VectorField F(cells);
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        default_thread_pool().resize(thread_counts[t]);
+
+        for (int m = 0; m < 2; m++) {
+            ScatterAccumulator scatter(schedules[m]);
+            scatter.run(n, reach, F, kernel);
+
+            start = Clock::now();
+            scatter.run(n, reach, F, kernel);
+
+            ScatterTiming row;
+            row.n = n;
+            row.schedule = names[m];
+            row.threads = default_thread_pool().thread_count();
+            row.reference_ms = reference_ms;
+            row.scatter_ms = elapsed_ms(start);
+            row.buffer_bytes = scatter.buffer_bytes();
+            measure_error(cells, F, F_ref, row);
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+void print_scatter_schedules(std::ostream& out, const std::vector<ScatterTiming>& rows) {
+    out << std::setw(6) << "n" << std::setw(12) << "schedule" << std::setw(9) << "threads"
+        << std::setw(14) << "reference ms" << std::setw(12) << "scatter ms" << std::setw(12) << "max error"
+        << std::setw(14) << "buffer KB" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const ScatterTiming& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(12) << row.schedule << std::setw(9) << row.threads
+            << std::fixed << std::setprecision(2)
+            << std::setw(14) << row.reference_ms << std::setw(12) << row.scatter_ms
+            << std::scientific << std::setprecision(2) << std::setw(12) << row.max_relative_error
+            << std::setw(14) << row.buffer_bytes / 1024 << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<NeighborListTiming> compare_neighbor_lists(int count, int steps, const std::vector<float>& skins) {
+    std::vector<NeighborListTiming> rows;
+    float side = (float)cbrt((double)count);
+    float cutoff = 2.0f;
+    float dt = 0.01f;
+
+    std::vector<float> x0(count);
+    std::vector<float> y0(count);
+    std::vector<float> z0(count);
+    std::vector<float> vx(count);
+    std::vector<float> vy(count);
+    std::vector<float> vz(count);
+    std::vector<float> q(count);
+    srand(7);
+    for (int i = 0; i < count; i++) {
+        x0[i] = (float)rand() / RAND_MAX * side;
+        y0[i] = (float)rand() / RAND_MAX * side;
+        z0[i] = (float)rand() / RAND_MAX * side;
+        vx[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        vy[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        vz[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        q[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
+
+    // Every run moves the points the same way, so the final forces of all of them agree
+    auto run = [&](float skin, NeighborListTiming& row, VectorField& F) {
+        std::vector<float> x(x0);
+        std::vector<float> y(y0);
+        std::vector<float> z(z0);
+        ShortRangeSolver solver;
+        solver.set_kernel(inverse_square_radial());
+        solver.set_cutoff(cutoff, 0.8f * cutoff);
+        solver.set_skin(skin);
+
+        Clock::time_point start = Clock::now();
+        for (int step = 0; step < steps; step++) {
+            for (int i = 0; i < count; i++) {
+                x[i] += vx[i] * dt;
+                y[i] += vy[i] * dt;
+                z[i] += vz[i] * dt;
+            }
+            solver.compute(count, x.data(), y.data(), z.data(), q.data(), q.data(), 1.0f, F);
+        }
+
+        row.count = count;
+        row.skin = skin;
+        row.steps = steps;
+        row.ms_per_step = elapsed_ms(start) / steps;
+        row.builds = skin > 0.0f ? solver.neighbor_list().build_count() : steps;
+        row.pairs_per_point = skin > 0.0f ? (float)solver.neighbor_list().pair_count() / count : 0.0f;
+    };
+
+    VectorField F_ref(count);
+    NeighborListTiming reference;
+    run(0.0f, reference, F_ref);
+
+    VectorField F(count);
+    for (size_t s = 0; s < skins.size(); s++) {
+        NeighborListTiming row;
+        run(skins[s], row, F);
+        measure_error(count, F, F_ref, row);
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+void print_neighbor_lists(std::ostream& out, const std::vector<NeighborListTiming>& rows) {
+    out << std::setw(9) << "points" << std::setw(8) << "skin" << std::setw(8) << "steps" << std::setw(8) << "builds"
+        << std::setw(12) << "pairs/pt" << std::setw(12) << "ms/step" << std::setw(12) << "max error" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const NeighborListTiming& row = rows[r];
+        out << std::setw(9) << row.count << std::fixed << std::setprecision(2) << std::setw(8) << row.skin
+            << std::setw(8) << row.steps << std::setw(8) << row.builds << std::setw(12) << row.pairs_per_point
+            << std::setw(12) << row.ms_per_step
+            << std::scientific << std::setprecision(2) << std::setw(12) << row.max_relative_error << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<CellOrderTiming> compare_cell_orders(const std::vector<int>& sizes, int max_tree_n) {
+    std::vector<CellOrderTiming> rows;
+    float h = 1.0f;
+
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int n = sizes[s];
+        int cells = n * n * n;
+        CellLayout row_major(n, CellOrder::RowMajor);
+        CellLayout morton(n, CellOrder::Morton);
+
+        ScalarField rho(cells);
+        fill_benchmark_density(n, h, rho);
+
+        if (n <= max_tree_n) {
+            BarnesHutSolver solver;
+            VectorField Fg(cells);
+            CellOrderTiming row;
+            row.n = n;
+            row.pass = "barnes-hut";
+
+            solver.set_target_order(CellOrder::RowMajor);
+            solver.build(n, h, rho);
+            Clock::time_point start = Clock::now();
+            solver.compute(Fg);
+            row.row_major_ms = elapsed_ms(start);
+
+            solver.set_target_order(CellOrder::Morton);
+            start = Clock::now();
+            solver.compute(Fg);
+            row.morton_ms = elapsed_ms(start);
+            rows.push_back(row);
+        }
+
+        // Laplacian of a field stored in each layout. Row-major finds the neighbors by index arithmetic; Morton
+        // by carrying through one coordinate's bits on power-of-two grids, where slots are codes, and through the
+        // slot table on others
+        ScalarField stored(cells);
+        ScalarField result(cells);
+        bool power_of_two = (n & (n - 1)) == 0;
+        uint32_t last = morton_encode(n - 1, n - 1, n - 1);
+        auto laplacian = [&](const CellLayout& layout) {
+            layout.from_row_major(rho, stored);
+            Clock::time_point start = Clock::now();
+            parallel_for(0, cells, [&](int begin, int end) {
+                for (int k = begin; k < end; k++) {
+                    float sum = -6.0f * stored[k];
+                    if (layout.order() == CellOrder::Morton && power_of_two) {
+                        uint32_t code = (uint32_t)k;
+                        for (int axis = 0; axis < 3; axis++) {
+                            uint32_t mask = 0x09249249u << axis;
+                            sum += stored[(code & mask) != 0 ? morton_decrement(code, axis) : code];
+                            sum += stored[(code & mask) != (last & mask) ? morton_increment(code, axis) : code];
+                        }
+                    }
+                    else {
+                        int i = layout.cell(k);
+                        int x = i % n;
+                        int y = (i / n) % n;
+                        int z = i / (n * n);
+                        int offsets[3][2] = {
+                            { x > 0 ? i - 1 : i, x < n - 1 ? i + 1 : i },
+                            { y > 0 ? i - n : i, y < n - 1 ? i + n : i },
+                            { z > 0 ? i - n * n : i, z < n - 1 ? i + n * n : i }
+                        };
+                        for (int axis = 0; axis < 3; axis++) {
+                            if (layout.order() == CellOrder::RowMajor) {
+                                sum += stored[offsets[axis][0]] + stored[offsets[axis][1]];
+                            }
+                            else {
+                                sum += stored[layout.slot(offsets[axis][0])] + stored[layout.slot(offsets[axis][1])];
+                            }
+                        }
+                    }
+                    result[k] = sum;
+                }
+            });
+            return elapsed_ms(start);
+        };
+
+        CellOrderTiming stencil;
+        stencil.n = n;
+        stencil.pass = "stencil";
+        stencil.row_major_ms = laplacian(row_major);
+        stencil.morton_ms = laplacian(morton);
+        rows.push_back(stencil);
+
+        CellOrderTiming conversion;
+        conversion.n = n;
+        conversion.pass = "conversion";
+        Clock::time_point start = Clock::now();
+        row_major.to_row_major(stored, result);
+        conversion.row_major_ms = elapsed_ms(start);
+        start = Clock::now();
+        morton.to_row_major(stored, result);
+        conversion.morton_ms = elapsed_ms(start);
+        rows.push_back(conversion);
+    }
+    return rows;
+}
+
+void print_cell_orders(std::ostream& out, const std::vector<CellOrderTiming>& rows) {
+    out << std::setw(6) << "n" << std::setw(12) << "pass" << std::setw(14) << "row-major ms" << std::setw(12) << "morton ms"
+        << std::setw(10) << "speedup" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const CellOrderTiming& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(12) << row.pass << std::fixed << std::setprecision(2)
+            << std::setw(14) << row.row_major_ms << std::setw(12) << row.morton_ms
+            << std::setw(10) << row.row_major_ms / row.morton_ms << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+namespace {
+    // Particles orbiting a unit mass at the origin, softened over epsilon so close passes stay finite:
+    // U = -m / sqrt(r^2 + epsilon^2)
+    const float orbit_softening = 0.1f;
+
+    void orbit_acceleration(ParticleStore& p, const int* active, int count) {
+        parallel_for(0, count, [&](int begin, int end) {
+            for (int a = begin; a < end; a++) {
+                int k = active ? active[a] : a;
+                float r2 = p.x[k] * p.x[k] + p.y[k] * p.y[k] + p.z[k] * p.z[k] + orbit_softening * orbit_softening;
+                float inv_r3 = 1.0f / (r2 * sqrt(r2));
+                p.ax[k] = -p.x[k] * inv_r3;
+                p.ay[k] = -p.y[k] * inv_r3;
+                p.az[k] = -p.z[k] * inv_r3;
+            }
+        });
+    }
+
+    double orbit_energy(const ParticleStore& p) {
+        double potential = 0.0;
+        for (int k = 0; k < p.size(); k++) {
+            double r2 = (double)p.x[k] * p.x[k] + (double)p.y[k] * p.y[k] + (double)p.z[k] * p.z[k] +
+                orbit_softening * orbit_softening;
+            potential -= p.m[k] / sqrt(r2);
+        }
+        return kinetic_energy(p) + potential;
+    }
+
+    // Eccentric orbits at radii from r_min to r_max, denser towards the center when clustered, with 70% to 100% of
+    // the circular speed in a random direction
+    void fill_orbits(ParticleStore& p, int count, float r_min, float r_max, bool clustered) {
+        p.resize(count);
+        srand(11);
+        for (int k = 0; k < count; k++) {
+            float u = (float)rand() / RAND_MAX;
+            float r = clustered ? r_min * pow(r_max / r_min, u) : r_min + (r_max - r_min) * u;
+            float speed = (0.7f + 0.3f * rand() / RAND_MAX) / sqrt(r);
+            float angle = 6.2831853f * rand() / RAND_MAX;
+            p.x[k] = r;
+            p.vy[k] = speed * cos(angle);
+            p.vz[k] = speed * sin(angle);
+            p.m[k] = 1.0f;
+        }
+        p.update_inverse_mass();
+    }
+
+    IntegratorDrift run_orbits(ParticleStore& p, ParticleIntegrator& integrator, const char* scheme, float dt, int steps) {
+        IntegratorDrift row;
+        row.scheme = scheme;
+        row.dt = dt;
+        row.steps = steps;
+        row.max_energy_drift = 0.0;
+
+        double start_energy = orbit_energy(p);
+        Clock::time_point start = Clock::now();
+        for (int step = 0; step < steps; step++) {
+            integrator.step(p, dt, orbit_acceleration);
+            double drift = fabs(orbit_energy(p) - start_energy) / fabs(start_energy);
+            row.max_energy_drift = std::max(row.max_energy_drift, drift);
+        }
+        row.ms = elapsed_ms(start);
+        row.evaluations = integrator.particle_evaluations();
+        return row;
+    }
+}
+
+std::vector<IntegratorDrift> compare_integrators(int count, float duration, const std::vector<float>& time_steps) {
+    std::vector<IntegratorDrift> rows;
+    static const Integrator schemes[] = { Integrator::Euler, Integrator::Leapfrog };
+    static const char* names[] = { "euler", "leapfrog" };
+    for (size_t t = 0; t < time_steps.size(); t++) {
+        for (int s = 0; s < 2; s++) {
+            ParticleStore p;
+            fill_orbits(p, count, 0.5f, 2.0f, false);
+            ParticleIntegrator integrator(schemes[s]);
+            rows.push_back(run_orbits(p, integrator, names[s], time_steps[t], (int)(duration / time_steps[t] + 0.5f)));
+        }
+    }
+    return rows;
+}
+
+std::vector<IntegratorDrift> compare_block_steps(int count, float duration, float dt, int depth, float step_length) {
+    std::vector<IntegratorDrift> rows;
+    int steps = (int)(duration / dt + 0.5f);
+
+    // Global steps as long as the block steps' longest and as short as their shortest
+    for (int fine = 0; fine < 2; fine++) {
+        ParticleStore p;
+        fill_orbits(p, count, 0.05f, 4.0f, true);
+        ParticleIntegrator integrator(Integrator::Leapfrog);
+        float global_dt = fine ? dt / (1 << depth) : dt;
+        rows.push_back(run_orbits(p, integrator, "leapfrog", global_dt, fine ? steps << depth : steps));
+    }
+
+    ParticleStore p;
+    fill_orbits(p, count, 0.05f, 4.0f, true);
+    ParticleIntegrator integrator(Integrator::Leapfrog);
+    integrator.set_block_steps(depth, step_length);
+    rows.push_back(run_orbits(p, integrator, "block", dt, steps));
+    return rows;
+}
+
+void print_integrator_drift(std::ostream& out, const std::vector<IntegratorDrift>& rows) {
+    out << std::setw(10) << "scheme" << std::setw(10) << "dt" << std::setw(8) << "steps" << std::setw(13) << "evaluations"
+        << std::setw(14) << "energy drift" << std::setw(10) << "ms" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const IntegratorDrift& row = rows[r];
+        out << std::setw(10) << row.scheme << std::setw(10) << row.dt << std::setw(8) << row.steps
+            << std::setw(13) << row.evaluations << std::scientific << std::setprecision(2)
+            << std::setw(14) << row.max_energy_drift << std::fixed << std::setw(10) << row.ms << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+namespace {
+    // Time one call of pass. With warm it runs once untimed first, so the tables and buffers a first call sets up
+    // stay out of the time.
+    template <typename Pass>
+    double time_ms(Pass pass, bool warm = false) {
+        if (warm) {
+            pass();
+        }
+        Clock::time_point start = Clock::now();
+        pass();
+        return elapsed_ms(start);
+    }
+
+    // Row of a force check comparing the count entries of F with those of F_ref
+    ForceCheck force_check(int n, const char* check, const char* variant, double reference_ms, double optimized_ms,
+        int count, const VectorField& F, const VectorField& F_ref) {
+        ForceCheck row;
+        row.n = n;
+        row.check = check;
+        row.variant = variant;
+        row.reference_ms = reference_ms;
+        row.optimized_ms = optimized_ms;
+        measure_error(count, F, F_ref, row);
+        return row;
+    }
+
+    void append(std::vector<ForceCheck>& rows, const std::vector<ForceCheck>& more) {
+        rows.insert(rows.end(), more.begin(), more.end());
+    }
+}
+
+void print_force_checks(std::ostream& out, const std::vector<ForceCheck>& rows) {
+    out << std::setw(6) << "n" << std::setw(18) << "check" << std::setw(16) << "variant"
+        << std::setw(14) << "reference ms" << std::setw(14) << "optimized ms" << std::setw(12) << "max error"
+        << std::setw(12) << "rms error" << "\n";
+
+    for (size_t r = 0; r < rows.size(); r++) {
+        const ForceCheck& row = rows[r];
+        out << std::setw(6) << row.n << std::setw(18) << row.check << std::setw(16) << row.variant
+            << std::fixed << std::setprecision(2)
+            << std::setw(14) << row.reference_ms << std::setw(14) << row.optimized_ms
+            << std::scientific << std::setprecision(2) << std::setw(12) << row.max_relative_error
+            << std::setw(12) << row.rms_relative_error << "\n";
+        out << std::defaultfloat;
+    }
+}
+
+std::vector<ForceCheck> compare_kernel_tables(const std::vector<int>& sizes) {
+    std::vector<ForceCheck> rows;
+    float h = 1.0f;
+    static const char* names[] = { "gravity", "inverse square", "weak" };
+    static const OffsetKernelTable::Magnitude magnitudes[] = { gravity_kernel, inverse_square_kernel, weak_kernel };
+
+    for (size_t t = 0; t < sizes.size(); t++) {
+        int n = sizes[t];
+        int side = 2 * n - 1;
+        int offsets = side * side * side;
+        VectorField F_ref(offsets);
+        VectorField F(offsets);
+
+        for (int k = 0; k < 3; k++) {
+            double reference_ms = time_ms([&] {
+                for (int o = 0; o < offsets; o++) {
+                    int di = o % side - (n - 1);
+                    int dj = (o / side) % side - (n - 1);
+                    int dk = o / (side * side) - (n - 1);
+                    double value[3];
+                    if (k == 0) {
+                        gravity_offset_kernel(di, dj, dk, h, value);
+                    }
+                    else if (k == 1) {
+                        inverse_square_offset_kernel(di, dj, dk, h, 1.0f, value);
+                    }
+                    else {
+                        weak_offset_kernel(di, dj, dk, h, value);
+                    }
+                    F_ref.set(o, (float)value[0], (float)value[1], (float)value[2]);
+                }
+            });
+
+            // A table built by an earlier pass would hide the build time
+            kernel_table_cache().clear();
+            std::shared_ptr<const OffsetKernelTable> table;
+            double table_ms = time_ms([&] {
+                table = kernel_table_cache().table(names[k], n, h, magnitudes[k]);
+                for (int o = 0; table && o < offsets; o++) {
+                    float value[3];
+                    table->lookup(o % side - (n - 1), (o / side) % side - (n - 1), o / (side * side) - (n - 1), value);
+                    F.set(o, value[0], value[1], value[2]);
+                }
+            });
+            if (table) {
+                rows.push_back(force_check(n, "kernel table", names[k], reference_ms, table_ms, offsets, F, F_ref));
+            }
+        }
+    }
+
+    return rows;
+}
+
+std::vector<ForceCheck> compare_short_range(const std::vector<int>& sizes, float cutoff) {
+    std::vector<ForceCheck> rows;
+    float h = 1.0f;
+    static const char* names[] = { "hard cutoff", "switched" };
+    const float switch_on[] = { cutoff, 0.75f * cutoff };
+
+    for (size_t t = 0; t < sizes.size(); t++) {
+        int n = sizes[t];
+        int cells = n * n * n;
+        std::vector<float> q(cells);
+        fill_benchmark_charge(n, q.data());
+
+        for (int v = 0; v < 2; v++) {
+            ShortRangeSolver solver;
+            solver.set_kernel(inverse_square_radial());
+            solver.set_cutoff(cutoff, switch_on[v]);
+
+            // Reference: every cell against every other, keeping the pairs within the cutoff
+            VectorField F_ref(cells);
+            double reference_ms = time_ms([&] {
+                parallel_for(0, cells, [&](int begin, int end) {
+                    for (int i = begin; i < end; i++) {
+                        float fx = 0.0f;
+                        float fy = 0.0f;
+                        float fz = 0.0f;
+                        for (int j = 0; j < cells; j++) {
+                            float dx = (i % n - j % n) * h;
+                            float dy = ((i / n) % n - (j / n) % n) * h;
+                            float dz = (i / (n * n) - j / (n * n)) * h;
+                            float r = sqrt(dx * dx + dy * dy + dz * dz);
+                            if (r <= 0.0f || r >= cutoff) {
+                                continue;
+                            }
+
+                            float w = q[j] * solver.force(r) / r;
+                            fx += w * dx;
+                            fy += w * dy;
+                            fz += w * dz;
+                        }
+                        F_ref.set(i, q[i] * fx, q[i] * fy, q[i] * fz);
+                    }
+                });
+            });
+
+            VectorField F(cells);
+            double solver_ms = time_ms([&] { solver.compute(n, h, q.data(), q.data(), 1.0f, F); }, true);
+            rows.push_back(force_check(n, "short range", names[v], reference_ms, solver_ms, cells, F, F_ref));
+        }
+    }
+
+    return rows;
+}
+
+ForceCheck compare_particle_sort(int n, int per_cell, int steps, int interval) {
+    int cells = n * n * n;
+    int count = cells * per_cell;
+    float h = 1.0f;
+    float dt = 0.05f;
+
+    ScalarField rho(cells);
+    fill_benchmark_density(n, h, rho);
+    VectorField field(cells);
+    PairForceSolver gravity;
+    gravity.set_kernel(gravity_radial());
+    gravity.compute(n, h, rho, nullptr, 1.0f, field);
+
+    std::vector<float> start_x(count);
+    std::vector<float> start_y(count);
+    std::vector<float> start_z(count);
+    std::vector<float> start_v(3 * count);
+    srand(11);
+    for (int k = 0; k < count; k++) {
+        start_x[k] = (float)rand() / RAND_MAX * (n - 1) * h;
+        start_y[k] = (float)rand() / RAND_MAX * (n - 1) * h;
+        start_z[k] = (float)rand() / RAND_MAX * (n - 1) * h;
+        for (int c = 0; c < 3; c++) {
+            start_v[3 * k + c] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        }
+    }
+
+    // Every run starts from the same particles; the force on each particle at the last step is stored by id
+    auto run = [&](int interval, VectorField& F) {
+        ParticleStore store;
+        store.set_grid(n, h);
+        store.resize(count);
+        for (int k = 0; k < count; k++) {
+            store.x[k] = start_x[k];
+            store.y[k] = start_y[k];
+            store.z[k] = start_z[k];
+            store.vx[k] = start_v[3 * k];
+            store.vy[k] = start_v[3 * k + 1];
+            store.vz[k] = start_v[3 * k + 2];
+        }
+        store.set_sort_interval(interval);
+
+        double ms = time_ms([&] {
+            for (int step = 0; step < steps; step++) {
+                parallel_for(0, count, [&](int begin, int end) {
+                    for (int k = begin; k < end; k++) {
+                        int c = store.cell_of(k);
+                        store.ax[k] = field.x[c];
+                        store.ay[k] = field.y[c];
+                        store.az[k] = field.z[c];
+                        store.vx[k] += store.ax[k] * dt;
+                        store.vy[k] += store.ay[k] * dt;
+                        store.vz[k] += store.az[k] * dt;
+                        store.x[k] += store.vx[k] * dt;
+                        store.y[k] += store.vy[k] * dt;
+                        store.z[k] += store.vz[k] * dt;
+                    }
+                });
+                store.step();
+            }
+        });
+
+        for (int k = 0; k < count; k++) {
+            F.set(store.id(k), store.ax[k], store.ay[k], store.az[k]);
+        }
+        return ms;
+    };
+
+    VectorField F_ref(count);
+    VectorField F(count);
+    double reference_ms = run(0, F_ref);
+    double sorted_ms = run(interval, F);
+    return force_check(n, "particle sort", "sorted", reference_ms, sorted_ms, count, F, F_ref);
+}
+
+std::vector<ForceCheck> compare_pair_tiles(const std::vector<int>& sizes) {
+    std::vector<ForceCheck> rows;
+    float h = 1.0f;
+
+    for (size_t t = 0; t < sizes.size(); t++) {
+        int n = sizes[t];
+        int cells = n * n * n;
+        ScalarField rho(cells);
+        fill_benchmark_density(n, h, rho);
+
+        // A source tile larger than the grid leaves the traversal untiled
+        PairTiles whole = default_pair_tiles();
+        whole.source = 1 << 30;
+        PairForceSolver untiled;
+        untiled.set_kernel(gravity_radial());
+        untiled.set_tiles(whole);
+        PairForceSolver tiled;
+        tiled.set_kernel(gravity_radial());
+
+        VectorField F_ref(cells);
+        VectorField F(cells);
+        double reference_ms = time_ms([&] { untiled.compute(n, h, rho, nullptr, 1.0f, F_ref); }, true);
+        double tiled_ms = time_ms([&] { tiled.compute(n, h, rho, nullptr, 1.0f, F); }, true);
+        rows.push_back(force_check(n, "pair tiles", "default tiles", reference_ms, tiled_ms, cells, F, F_ref));
+    }
+
+    return rows;
+}
+
+namespace {
+    // Step a dataset from the charges given, recalculating every force each step when interval is 1 and leaving
+    // slow forces to multiple time stepping otherwise; the particle velocities end up in V by id
+    double run_force_intervals(CMBDataset& dataset, const float* q, int steps, float dt, int interval, VectorField& V) {
+        for (int i = 0; i < dataset.cell_count(); i++) {
+            dataset.q[i] = q[i];
+        }
+        dataset.set_time_step(dt);
+        dataset.set_integrator(Integrator::Leapfrog);
+        dataset.set_force_interval(gravity_force | electromagnetic_force, interval);
+        dataset.calculate_forces();
+
+        double ms = time_ms([&] {
+            for (int step = 0; step < steps; step++) {
+                if (interval == 1) {
+                    dataset.calculate_forces();
+                }
+                dataset.update_grid();
+            }
+        });
+
+        const ParticleStore& particles = dataset.particles;
+        for (int k = 0; k < particles.size(); k++) {
+            V.set(particles.id(k), particles.vx[k], particles.vy[k], particles.vz[k]);
+        }
+        return ms;
+    }
+}
+
+std::vector<ForceCheck> compare_force_intervals(int n, int steps, float dt, int interval) {
+    std::vector<ForceCheck> rows;
+
+    // The same charges for every run, since each dataset draws its own
+    std::vector<float> q(n * n * n);
+    fill_benchmark_charge(n, q.data());
+    {
+        CMBDataset single(n);
+        CMBDataset multiple(n);
+        VectorField V_ref(n * n * n);
+        VectorField V(n * n * n);
+        double reference_ms = run_force_intervals(single, q.data(), steps, dt, 1, V_ref);
+        double multiple_ms = run_force_intervals(multiple, q.data(), steps, dt, interval, V);
+        rows.push_back(force_check(n, "force intervals", "dataset", reference_ms, multiple_ms, n * n * n, V, V_ref));
+    }
+
+    const int preset = 12;
+    std::vector<float> preset_q(preset * preset * preset);
+    fill_benchmark_charge(preset, preset_q.data());
+    {
+        FixedCMBDataset<preset> single;
+        FixedCMBDataset<preset> multiple;
+        VectorField V_ref(single.cell_count());
+        VectorField V(single.cell_count());
+        double reference_ms = run_force_intervals(single, preset_q.data(), steps, dt, 1, V_ref);
+        double multiple_ms = run_force_intervals(multiple, preset_q.data(), steps, dt, interval, V);
+        rows.push_back(force_check(preset, "force intervals", "fixed preset", reference_ms, multiple_ms,
+            single.cell_count(), V, V_ref));
+    }
+
+    return rows;
+}
+
+ForceCheck compare_particle_gravity(int n, int steps, float cutoff, float skin) {
+    int cells = n * n * n;
+
+    // Every run starts from the same velocities; the cell forces are cleared, so only the pairs move the particles
+    auto run = [&](float run_skin, VectorField& A) {
+        CMBDataset dataset(n);
+        dataset.set_particle_gravity(cutoff, run_skin);
+        dataset.set_time_step(0.05f * h);
+        dataset.Fn.fill_zero();
+        srand(17);
+        for (int k = 0; k < dataset.particles.size(); k++) {
+            dataset.particles.vx[k] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+            dataset.particles.vy[k] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+            dataset.particles.vz[k] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        }
+
+        double ms = time_ms([&] {
+            for (int step = 0; step < steps; step++) {
+                dataset.update_grid();
+            }
+        });
+
+        const ParticleStore& particles = dataset.particles;
+        for (int k = 0; k < particles.size(); k++) {
+            A.set(particles.id(k), particles.ax[k], particles.ay[k], particles.az[k]);
+        }
+        return ms;
+    };
+
+    VectorField A_ref(cells);
+    VectorField A(cells);
+    double reference_ms = run(0.0f, A_ref);
+    double listed_ms = run(skin, A);
+    return force_check(n, "particle gravity", "Verlet list", reference_ms, listed_ms, cells, A, A_ref);
+}
+
+std::vector<ForceCheck> compare_incremental_forces(int n) {
+    std::vector<ForceCheck> rows;
+    static const float fractions[] = { 0.001f, 0.01f, 0.1f };
+    static const char* names[] = { "0.1% changed", "1% changed", "10% changed" };
+
+    CMBDataset dataset(n);
+    int cells = dataset.cell_count();
+    VectorField F(cells);
+    srand(13);
+    for (int f = 0; f < 3; f++) {
+        // A full pass seeds the tracking; every change is then taken incrementally
+        dataset.set_incremental(true, 0.0f, 1.0f);
+        dataset.calculate_forces();
+
+        int changed = std::max(1, (int)(fractions[f] * cells));
+        for (int c = 0; c < changed; c++) {
+            int i = rand() % cells;
+            dataset.rho[i] *= 1.5f;
+            dataset.q[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+        }
+
+        double incremental_ms = time_ms([&] { dataset.calculate_forces(); });
+        for (int i = 0; i < cells; i++) {
+            F.set(i, dataset.Fn.x[i], dataset.Fn.y[i], dataset.Fn.z[i]);
+        }
+
+        dataset.set_incremental(false);
+        double full_ms = time_ms([&] { dataset.calculate_forces(); });
+        rows.push_back(force_check(n, "incremental", names[f], full_ms, incremental_ms, cells, F, dataset.Fn));
+    }
+
+    return rows;
+}
+
+namespace {
+    // CMBDataset that can also evaluate its fields without the dataflow graph, for the reference of the dataflow
+    // checks
+    class SequentialDataset : public CMBDataset {
+    public:
+        explicit SequentialDataset(int n) :
+            CMBDataset(n)
+        {
+        }
+
+        // rho, g, every force and Fn from the parameters given and the current q, running each pass once in order
+        void evaluate(float inflation, float dark_matter, float dark_energy) {
+            m_inflation = inflation;
+            m_dark_matter = dark_matter;
+            m_dark_energy = dark_energy;
+            compute_density();
+            compute_mass_table();
+            compute_gravity_field();
+            prepare_convolutions();
+            calculate_gravity();
+            calculate_electromagnetism();
+            calculate_weak_nuclear();
+            calculate_strong_nuclear();
+            calculate_total_force();
+        }
+    };
+
+    void store_positions(const ParticleStore& particles, VectorField& X) {
+        for (int k = 0; k < particles.size(); k++) {
+            X.set(particles.id(k), particles.x[k], particles.y[k], particles.z[k]);
+        }
+    }
+}
+
+std::vector<ForceCheck> compare_dataflow_refresh(int n) {
+    std::vector<ForceCheck> rows;
+    float dark_energy = 0.5f * dark_energy_init;
+
+    CMBDataset graph(n);
+    SequentialDataset sequential(n);
+    int cells = graph.cell_count();
+    graph.refresh();
+
+    // A parameter change recomputes rho and what depends on it; the charges and the forces they alone drive are kept
+    double graph_ms = time_ms([&] {
+        graph.initialize(inflation_init, dark_matter_init, dark_energy);
+        graph.refresh();
+    });
+    for (int i = 0; i < cells; i++) {
+        sequential.q[i] = graph.q[i];
+    }
+    double sequential_ms = time_ms([&] { sequential.evaluate(inflation_init, dark_matter_init, dark_energy); });
+
+    VectorField g(cells);
+    VectorField g_ref(cells);
+    for (int i = 0; i < cells; i++) {
+        g.set(i, graph.g[i], 0.0f, 0.0f);
+        g_ref.set(i, sequential.g[i], 0.0f, 0.0f);
+    }
+    rows.push_back(force_check(n, "dataflow refresh", "parameters Fn", sequential_ms, graph_ms, cells, graph.Fn,
+        sequential.Fn));
+    rows.push_back(force_check(n, "dataflow refresh", "parameters g", sequential_ms, graph_ms, cells, g, g_ref));
+
+    // New charges recompute the charge forces and Fn only. Recomputing rho would also put the particles back on
+    // the cell centers, so they are moved off them first and must stay where they are.
+    ParticleStore& particles = graph.particles;
+    for (int k = 0; k < particles.size(); k++) {
+        particles.x[k] += 0.25f * h;
+    }
+    VectorField X_ref(particles.size());
+    VectorField X(particles.size());
+    store_positions(particles, X_ref);
+
+    graph_ms = time_ms([&] {
+        graph.randomize_charges();
+        graph.refresh();
+    });
+    store_positions(particles, X);
+    for (int i = 0; i < cells; i++) {
+        sequential.q[i] = graph.q[i];
+    }
+    sequential_ms = time_ms([&] { sequential.evaluate(inflation_init, dark_matter_init, dark_energy); });
+
+    rows.push_back(force_check(n, "dataflow refresh", "charges Fn", sequential_ms, graph_ms, cells, graph.Fn,
+        sequential.Fn));
+    rows.push_back(force_check(n, "dataflow refresh", "particles kept", sequential_ms, graph_ms, particles.size(), X,
+        X_ref));
+    return rows;
+}
+
+int run_force_checks(std::ostream& out) {
+    // Largest errors each check may show at these sizes; the exact paths only differ by float rounding
+    struct Tolerance {
+        const char* check;
+        float max_relative_error;
+        float rms_relative_error;
+    };
+    static const Tolerance tolerances[] = {
+        { "kernel table", 1e-6f, 1e-7f },
+        { "short range", 1e-4f, 1e-5f },
+        { "particle sort", 0.0f, 0.0f },
+        { "pair tiles", 1e-4f, 1e-5f },
+        { "force intervals", 1e-5f, 1e-6f },
+        { "particle gravity", 1e-5f, 1e-6f },
+        { "incremental", 1e-4f, 1e-5f },
+        { "dataflow refresh", 1e-6f, 1e-7f },
+    };
+
+    std::vector<ForceCheck> rows;
+    append(rows, compare_kernel_tables({ 12 }));
+    append(rows, compare_short_range({ 12 }, 3.0f));
+    rows.push_back(compare_particle_sort(24, 4, 20, 8));
+    append(rows, compare_pair_tiles({ 24 }));
+    append(rows, compare_force_intervals(12, 8, 1e-9f, 4));
+    rows.push_back(compare_particle_gravity(12, 40, 2.0f, 0.25f));
+    append(rows, compare_incremental_forces(12));
+    append(rows, compare_dataflow_refresh(12));
+    print_force_checks(out, rows);
+
+    int failures = 0;
+    for (size_t r = 0; r < rows.size(); r++) {
+        const ForceCheck& row = rows[r];
+        const Tolerance* tolerance = nullptr;
+        for (size_t t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]); t++) {
+            if (std::string(tolerances[t].check) == row.check) {
+                tolerance = &tolerances[t];
+            }
+        }
+
+        // NaN fails both comparisons, so it is caught as well
+        bool passed = tolerance && row.max_relative_error <= tolerance->max_relative_error &&
+            row.rms_relative_error <= tolerance->rms_relative_error;
+        if (!passed) {
+            out << "FAILED: " << row.check << ", " << row.variant << " at n = " << row.n << "\n";
+            failures++;
+        }
+    }
+    out << (failures == 0 ? "All force checks passed\n" : "Some force checks failed\n");
+    return failures;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Accuracy and timing of one gravity solver against the brute-force sum on an n*n*n grid
+struct GravityComparison {
+    int n;
+    const char* solver;
+    double reference_ms;     // Time taken by the brute-force sum, negative when it was skipped
+    double solver_ms;        // Time taken by the solver
+    float max_relative_error; // Largest per-cell |F - F_ref| / |F_ref|
+    float rms_relative_error; // ||F - F_ref|| / ||F_ref|| over the whole grid
+};
+
+// Fill rho with the dark matter profile used by CMBDataset::initialize
+void fill_benchmark_density(int n, float h, float* rho);
+
+// Run every approximate gravity solver against the brute-force sum for each grid size.
+// Grids larger than max_direct_n are only timed, since the brute-force sum would take too long there.
+std::vector<GravityComparison> compare_gravity_solvers(const std::vector<int>& sizes, float opening_angle, int max_direct_n = 24);
+
+// Print the comparison as a table with one row per grid size and solver
+void print_gravity_comparison(std::ostream& out, const std::vector<GravityComparison>& rows);
+
+// Accuracy of the fast multipole solver at one expansion order against direct summation on an n*n*n grid
+struct MultipoleAccuracy {
+    int n;
+    int order;
+    const char* source;       // "rho" for gravity, "q" for the inverse-square charge forces
+    double reference_ms;
+    double solver_ms;
+    float max_relative_error;
+    float rms_relative_error;
+    size_t table_bytes;       // Memory held by the interaction operators
+};
+
+// Fill q with random charges between -1 and 1, as CMBDataset::initialize does
+void fill_benchmark_charge(int n, float* q);
+
+// Run the fast multipole solver at every order for both rho and q sources against the direct sum
+std::vector<MultipoleAccuracy> compare_multipole_orders(int n, const std::vector<int>& orders);
+
+// Print the multipole accuracy as a table with one row per order and source
+void print_multipole_accuracy(std::ostream& out, const std::vector<MultipoleAccuracy>& rows);
+
+// Time per pass over the force fields with every component interleaved per cell and with separate x, y and z streams
+struct LayoutBandwidth {
+    int n;
+    const char* pass;       // "total force" sums all components of four forces, "x only" sums one component
+    double interleaved_ms;
+    double soa_ms;
+    double interleaved_gbs; // Bytes the pass needs divided by the time, in GB/s
+    double soa_gbs;
+};
+
+// Time both passes in both layouts for each grid size, averaged over repeats
+std::vector<LayoutBandwidth> compare_field_layouts(const std::vector<int>& sizes, int repeats = 10);
+
+// Print the layout comparison as a table with one row per grid size and pass
+void print_layout_bandwidth(std::ostream& out, const std::vector<LayoutBandwidth>& rows);
+
+// Accuracy and timing of the pair kernels at one SIMD level against the scalar brute-force sums
+struct PairKernelTiming {
+    int n;
+    const char* kernel;       // Name of the SIMD level
+    const char* traversal;    // "full" for every ordered pair, "symmetric" for every unordered pair once
+    const char* source;       // "rho" for gravity, "q" for the inverse-square charge forces
+    double reference_ms;      // Time taken by direct_gravity or direct_inverse_square
+    double kernel_ms;
+    float max_relative_error;
+    float rms_relative_error;
+};
+
+// Run PairForceSolver at every SIMD level the CPU supports with both traversals for both sources, for each grid size
+std::vector<PairKernelTiming> compare_pair_kernels(const std::vector<int>& sizes);
+
+// Print the pair kernel comparison as a table with one row per grid size, source, level and traversal
+void print_pair_kernels(std::ostream& out, const std::vector<PairKernelTiming>& rows);
+
+// Time of one solver pass at one thread count, relative to the first thread count of the run (normally 1)
+struct ThreadScaling {
+    int n;
+    const char* pass;
+    int threads;
+    double ms;
+    double speedup;    // Time at the first thread count divided by this time
+    double efficiency; // Speedup per added thread, 1 for perfect scaling
+};
+
+// Time the pair kernels, Barnes-Hut, the particle mesh and the fast multipole solver on an n*n*n grid at every
+// thread count, resizing the default pool; the pool is left at the last count
+std::vector<ThreadScaling> compare_thread_scaling(int n, const std::vector<int>& thread_counts);
+
+// Print the scaling as a table with one row per pass and thread count
+void print_thread_scaling(std::ostream& out, const std::vector<ThreadScaling>& rows);
+
+// Timing of the weak force's Newton's-third-law stencil with one scatter schedule against a serial gather
+struct ScatterTiming {
+    int n;
+    const char* schedule;     // "privatized" or "colored"
+    int threads;
+    double reference_ms;      // Serial loop where every cell sums its full stencil, writing only to itself
+    double scatter_ms;
+    float max_relative_error;
+    float rms_relative_error;
+    size_t buffer_bytes;      // Memory held by the private buffers
+};
+
+// Run the half-stencil weak kernel with both schedules at every thread count on an n*n*n grid of random charges,
+// resizing the default pool; the pool is left at the last count
+std::vector<ScatterTiming> compare_scatter_schedules(int n, const std::vector<int>& thread_counts);
+
+// Print the schedule comparison as a table with one row per thread count and schedule
+void print_scatter_schedules(std::ostream& out, const std::vector<ScatterTiming>& rows);
+
+// Timing of the short-range solver over steps of drifting points with one Verlet skin
+struct NeighborListTiming {
+    int count;
+    float skin;               // 0 bins the points afresh every step
+    int steps;
+    int builds;               // Verlet list builds over the run
+    float pairs_per_point;    // Listed pairs per point at the last build, within cutoff + skin
+    double ms_per_step;
+    float max_relative_error; // Against the forces with no skin at the last step
+    float rms_relative_error;
+};
+
+// Move count random points of unit density by small random velocities for steps steps, evaluating a switched
+// inverse-square force with a cutoff of 2 every step, once for every skin
+std::vector<NeighborListTiming> compare_neighbor_lists(int count, int steps, const std::vector<float>& skins);
+
+// Print the neighbor list comparison as a table with one row per skin
+void print_neighbor_lists(std::ostream& out, const std::vector<NeighborListTiming>& rows);
+
+// Time of one pass over an n*n*n grid with the cells in row-major and in Morton order
+struct CellOrderTiming {
+    int n;
+    const char* pass;  // "barnes-hut" visits the targets in each order, "stencil" sweeps a 7-point Laplacian over a
+                       // field stored in each order, "conversion" copies a field against converting it to row-major
+    double row_major_ms;
+    double morton_ms;
+};
+
+// Time the passes for each grid size; Barnes-Hut only runs up to max_tree_n, where it takes seconds
+std::vector<CellOrderTiming> compare_cell_orders(const std::vector<int>& sizes, int max_tree_n = 64);
+
+// Print the cell order comparison as a table with one row per grid size and pass
+void print_cell_orders(std::ostream& out, const std::vector<CellOrderTiming>& rows);
+
+// Energy conservation of one integrator at one time step, on particles orbiting a softened point mass
+struct IntegratorDrift {
+    const char* scheme;     // "euler", "leapfrog" or "block" for leapfrog with block steps
+    float dt;
+    int steps;
+    long long evaluations;  // Particle accelerations evaluated over the run
+    double max_energy_drift; // Largest |E - E0| / |E0| over the run
+    double ms;
+};
+
+// Integrate count particles for the same simulated time at every time step with both schemes
+std::vector<IntegratorDrift> compare_integrators(int count, float duration, const std::vector<float>& time_steps);
+
+// Integrate count particles clustered towards the point mass for the same simulated time with leapfrog at dt, with
+// leapfrog at dt / 2^depth and with block steps of dt down to dt / 2^depth
+std::vector<IntegratorDrift> compare_block_steps(int count, float duration, float dt, int depth, float step_length);
+
+// Print the integrator comparison as a table with one row per scheme and time step
+void print_integrator_drift(std::ostream& out, const std::vector<IntegratorDrift>& rows);
+
+// Accuracy and timing of one optimized force path against the plain computation it replaces
+struct ForceCheck {
+    int n;                    // Cells in each dimension
+    const char* check;        // What is compared
+    const char* variant;      // Setting of the optimized path
+    double reference_ms;
+    double optimized_ms;
+    float max_relative_error;
+    float rms_relative_error;
+};
+
+// Print force checks as a table with one row per check and variant
+void print_force_checks(std::ostream& out, const std::vector<ForceCheck>& rows);
+
+// Look up every offset of an n*n*n grid in the shared gravity, inverse-square and weak tables, against the
+// offset kernels of ForceKernels.h evaluated directly; the optimized time includes building the table
+std::vector<ForceCheck> compare_kernel_tables(const std::vector<int>& sizes);
+
+// Short-range inverse-square forces between random charges on an n*n*n grid with a hard and a switched cutoff,
+// through the cell list against a direct sum over all pairs closer than the cutoff
+std::vector<ForceCheck> compare_short_range(const std::vector<int>& sizes, float cutoff);
+
+// Move per_cell random particles per cell of an n*n*n grid through the gravity field of the benchmark density for
+// steps steps, each particle taking the force of the cell it is in, with the store sorted by cell every interval
+// steps against never sorted; particles are matched by id
+ForceCheck compare_particle_sort(int n, int per_cell, int steps, int interval);
+
+// Full-traversal gravity of the benchmark density with the default cache tiles against one source tile covering
+// the whole grid, for each grid size
+std::vector<ForceCheck> compare_pair_tiles(const std::vector<int>& sizes);
+
+// Move the particles of an n*n*n CMBDataset, and of a 12^3 FixedCMBDataset preset, for steps steps of dt with
+// gravity and the electromagnetic force recalculated every interval steps by multiple time stepping, against
+// every force recalculated every step; particle velocities are compared by id
+std::vector<ForceCheck> compare_force_intervals(int n, int steps, float dt, int interval);
+
+// Move the particles of an n*n*n CMBDataset for steps steps at random unit velocities with only the gravity between
+// particles closer than cutoff acting, found through a Verlet list with the given skin against binning every step;
+// particle accelerations at the last step are compared by id
+ForceCheck compare_particle_gravity(int n, int steps, float cutoff, float skin);
+
+// Change rho and q in 0.1%, 1% and 10% of the cells of an n*n*n CMBDataset and update the forces incrementally
+// from the changed cells, against recalculating them in full
+std::vector<ForceCheck> compare_incremental_forces(int n);
+
+// Change the dark energy parameter of an n*n*n CMBDataset and bring it up to date through its dataflow graph,
+// against rho, g and the forces evaluated pass by pass from the same parameters and charges; then draw new charges
+// and refresh again, comparing Fn and checking that the particles, which a new rho would restart, are kept
+std::vector<ForceCheck> compare_dataflow_refresh(int n);
+
+// Run every force check above at a small size, print the rows and a line for each one over its tolerance, and
+// return how many failed. Define ENGINE_FORCE_CHECKS to run it when the app starts, with the report going to the
+// debugger output.
+int run_force_checks(std::ostream& out);
@@ -1,387 +1,878 @@
 #include "CMBDataset.h"
-
-CMBDataset::CMBDataset() {
-    initialize();
+#include "ForceKernels.h"
+#include "KernelTable.h"
+#include "Neighborhood.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+    // Kernel at an offset from the shared table, or evaluated directly when the table did not fit the cache
+    void sample_kernel(const OffsetKernelTable* table, int di, int dj, int dk, float h,
+        const OffsetKernelTable::Magnitude& magnitude, float* value) {
+        if (table) {
+            table->lookup(di, dj, dk, value);
+        }
+        else {
+            OffsetKernelTable::evaluate(di, dj, dk, h, magnitude, value);
+        }
+    }
 }
 
-void CMBDataset::initialize(float inflation, float dark_matter, float dark_energy) {
-    // Initialize the dataset with values based on a simplified model
-    for (int i = 0; i < N * N * N; i++) {
-        // Set the temperature of each cell based on the cosmic microwave background radiation
-        float T0 = 2.7255f;
-        float deltaT = 0.001f * sin(i % N) * sin((i / N) % N) * sin(i / (N * N));
-        T[i] = T0 + deltaT;
-
-        // Set the density of each cell based on the distribution of matter and energy in the universe
-        float r = sqrt(pow((i % N) - N / 2, 2) + pow(((i / N) % N) - N / 2, 2) + pow((i / (N * N)) - N / 2, 2));
-        float density = dark_matter * exp(-r / 10.0f) + dark_energy * exp(r / 10.0f) + inflation;
-        rho[i] = density;
-
-        // Set the charge of each cell to random values
-        // Set the charge of each cell to a random value between -1 and 1
-        q[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+CMBDataset::CMBDataset(int n) :
+    m_n(n),
+    m_dt(dt_init),
+    m_enabled_forces(all_forces),
+    m_step(0),
+    m_gravity_solver(GravitySolver::Convolution),
+    m_charge_solver(ChargeSolver::Convolution),
+    m_strong_cutoff(0.0f),
+    m_particle_cutoff(0.0f),
+    m_incremental(false),
+    m_max_dirty_fraction(0.02f),
+    m_inflation(0.0f),
+    m_dark_matter(0.0f),
+    m_dark_energy(0.0f)
+{
+    // Every field lives on the heap, so the grid size is only limited by memory
+    int cells = cell_count();
+    rho.resize(cells);
+    T.resize(cells);
+    gamma.resize(cells);
+    q.resize(cells);
+    g.resize(cells);
+    Fg.resize(cells);
+    Fe.resize(cells);
+    Fw.resize(cells);
+    Fs.resize(cells);
+    Fn.resize(cells);
+    m_electric_field.resize(cells);
+    m_weak_charge.resize(cells);
+    particles.set_grid(n, h);
+    particles.resize(cells);
+
+    m_gravity_multipole.set_kernel(
+        [](double r) { return (double)gravity_potential((float)r); },
+        [](double r) { return (double)gravity_kernel((float)r); });
+    m_charge_multipole.set_kernel(
+        [](double r) { return 1.0 / r; },
+        [](double r) { return 1.0 / (r * r); });
+    m_gravity_pairs.set_kernel(gravity_radial());
+    m_coulomb_pairs.set_kernel(inverse_square_radial());
+    m_strong_pairs.set_kernel(inverse_square_radial());
+    m_strong_short_range.set_kernel(inverse_square_radial());
+    m_particle_gravity.set_kernel(gravity_radial());
+    set_pair_traversal(PairTraversal::Symmetric);
+    for (int f = 0; f < 4; f++) {
+        m_force_interval[f] = 1;
+        m_force_start[f] = 0;
+        m_next_interval[f] = 1;
     }
 
-    // Cancel out the charges as much as possible
-    for (int i = 0; i < N * N * N; i++) {
-        float total_charge = 0.0f;
-
-        // Calculate the total charge in the neighborhood of each cell
-        for (int j = 0; j < N * N * N; j++) {
-            if (i == j) {
+    // Half of the weak stencil, one offset of each +/- pair, with the force it carries per unit weak charge
+    std::vector<StencilOffset> stencil = neighborhood_stencil(weak_cutoff, h);
+    int reach = (int)ceil(weak_cutoff / h);
+    std::shared_ptr<const OffsetKernelTable> weak = kernel_table_cache().table("weak", std::min(n, reach + 1), h, weak_kernel);
+    for (size_t s = 0; s < stencil.size(); s++) {
+        const StencilOffset& o = stencil[s];
+        if (o.dk > 0 || (o.dk == 0 && (o.dj > 0 || (o.dj == 0 && o.di > 0)))) {
+            // Offsets reaching past the grid never pair two cells
+            if (abs(o.di) >= n || abs(o.dj) >= n || o.dk >= n) {
                 continue;
             }
 
-            float dx = (i % N - j % N) * h;
-            float dy = ((i / N) % N - (j / N) % N) * h;
-            float dz = (i / (N * N) - j / (N * N)) * h;
+            float value[3];
+            sample_kernel(weak.get(), o.di, o.dj, o.dk, h, weak_kernel, value);
+            m_weak_stencil.push_back(o);
+            m_weak_table.push_back(value[0]);
+            m_weak_table.push_back(value[1]);
+            m_weak_table.push_back(value[2]);
+        }
+    }
+
+    build_fields();
+    initialize(inflation_init, dark_matter_init, dark_energy_init);
+}
 
-            float r = sqrt(dx * dx + dy * dy + dz * dz);
+void CMBDataset::set_gravity_solver(GravitySolver solver, float opening_angle) {
+    m_gravity_solver = solver;
+    m_rho_changes.stop();
+    m_fields.invalidate(m_nodes.forces[0]);
+    m_barnes_hut.set_opening_angle(opening_angle);
+}
 
-            if (r < 2.0f * h) {
-                total_charge += q[j];
-            }
-        }
+void CMBDataset::set_particle_mesh(PoissonBoundary boundary, GradientMethod gradient) {
+    m_particle_mesh.set_boundary(boundary);
+    m_particle_mesh.set_gradient(gradient);
+    m_fields.invalidate(m_nodes.forces[0]);
+}
+
+void CMBDataset::set_charge_solver(ChargeSolver solver) {
+    m_charge_solver = solver;
+    m_q_changes.stop();
+    m_fields.invalidate(m_nodes.forces[1]);
+    m_fields.invalidate(m_nodes.forces[3]);
+}
+
+void CMBDataset::set_pair_traversal(PairTraversal traversal) {
+    m_gravity_pairs.set_traversal(traversal);
+    m_coulomb_pairs.set_traversal(traversal);
+    m_strong_pairs.set_traversal(traversal);
+}
+
+size_t CMBDataset::kernel_table_bytes() const {
+    return kernel_table_cache().bytes();
+}
+
+void CMBDataset::set_strong_cutoff(float cutoff, float switch_on) {
+    m_strong_cutoff = cutoff;
+    if (cutoff > 0.0f) {
+        m_strong_short_range.set_cutoff(cutoff, switch_on < 0.0f ? cutoff : switch_on);
+    }
+    m_fields.invalidate(m_nodes.forces[3]);
+}
 
-        // Adjust the charge of each cell to cancel out the total charge in its neighborhood
-        q[i] -= total_charge / 26.0f;
+void CMBDataset::set_particle_gravity(float cutoff, float skin, float switch_on) {
+    m_particle_cutoff = cutoff;
+    if (cutoff > 0.0f) {
+        m_particle_gravity.set_cutoff(cutoff, switch_on < 0.0f ? cutoff : switch_on);
+        m_particle_gravity.set_skin(skin);
     }
 
-    // Adjust the gravity based on the distribution of dark matter structures
-    for (int i = 0; i < N * N * N; i++) {
-        float total_mass = 0.0f;
+    // Accelerations the integrator kept were taken with the old pairs
+    m_integrator.invalidate();
+}
 
-        // Calculate the total mass in the neighborhood of each cell
-        for (int j = 0; j < N * N * N; j++) {
-            if (i == j) {
-                continue;
-            }
+void CMBDataset::set_weak_scatter(ScatterSchedule schedule) {
+    m_weak_scatter.set_schedule(schedule);
+}
+
+void CMBDataset::set_multipole_order(int order) {
+    m_gravity_multipole.set_order(order);
+    m_charge_multipole.set_order(order);
+    m_fields.invalidate(m_nodes.forces[0]);
+    m_fields.invalidate(m_nodes.forces[1]);
+    m_fields.invalidate(m_nodes.forces[3]);
+}
+
+void CMBDataset::set_time_step(float dt) {
+    m_dt = dt;
+}
+
+bool CMBDataset::set_integrator(Integrator scheme) {
+    if (scheme != Integrator::Leapfrog && multiple_time_stepping()) {
+        return false;
+    }
+
+    m_integrator.set_scheme(scheme);
+    return true;
+}
+
+bool CMBDataset::set_block_steps(int depth, float step_length) {
+    if (depth > 0 && multiple_time_stepping()) {
+        return false;
+    }
+
+    m_integrator.set_block_steps(depth, step_length);
+    return true;
+}
 
-            float dx = (i % N - j % N) * h;
-            float dy = ((i / N) % N - (j / N) % N) * h;
-            float dz = (i / (N * N) - j / (N * N)) * h;
+bool CMBDataset::set_force_interval(unsigned forces, int steps) {
+    steps = std::max(1, steps);
+    if (steps > 1 && (m_integrator.scheme() != Integrator::Leapfrog || m_integrator.block_depth() > 0)) {
+        return false;
+    }
 
-            float r = sqrt(dx * dx + dy * dy + dz * dz);
+    for (int f = 0; f < 4; f++) {
+        if (forces & (1u << f)) {
+            m_next_interval[f] = steps;
 
-            if (r < 2.0f * h) {
-                float mass = rho[j] * h * h * h;
-                total_mass += mass;
+            // Between intervals the new one starts now; an open one closes first, in step_multiple
+            if ((m_step - m_force_start[f]) % m_force_interval[f] == 0) {
+                m_force_interval[f] = steps;
+                m_force_start[f] = m_step;
             }
         }
+    }
 
-    // Adjust the gravity of each cell based on the total mass in its neighborhood
-    float g = 6.6743e-11f;
-    float M = total_mass;
-    float r = h;
-    float F = g * M / (r * r);
-    float a = F / rho[i];
-    g[i] = a;
+    // Whichever of update_grid's two paths runs next, it must not reuse the other's kept accelerations
+    m_integrator.invalidate();
+    return true;
+}
+
+bool CMBDataset::multiple_time_stepping() const {
+    for (int f = 0; f < 4; f++) {
+        if (m_force_interval[f] > 1 || m_next_interval[f] > 1) {
+            return true;
+        }
     }
+    return false;
 }
 
-void CMBDataset::calculate_forces() {
-    // Calculate gravity forces
-    calculate_gravity();
+int CMBDataset::force_interval(unsigned force) const {
+    for (int f = 0; f < 4; f++) {
+        if (force & (1u << f)) {
+            return m_force_interval[f];
+        }
+    }
+    return 1;
+}
 
-    // Calculate electromagnetic forces
-    calculate_electromagnetism();
+double CMBDataset::kinetic_energy() const {
+    return ::kinetic_energy(particles);
+}
 
-    // Calculate weak nuclear forces
-    calculate_weak_nuclear();
+void CMBDataset::set_incremental(bool enabled, float tolerance, float max_dirty_fraction) {
+    m_incremental = enabled;
+    m_max_dirty_fraction = max_dirty_fraction;
+    m_rho_changes.set_tolerance(tolerance);
+    m_q_changes.set_tolerance(tolerance);
 
-    // Calculate strong nuclear forces
-    calculate_strong_nuclear();
+    // The forces may have been calculated by other means while tracking was off, so the next pass starts afresh
+    m_rho_changes.stop();
+    m_q_changes.stop();
 }
 
-void CMBDataset::update_grid() {
-    // Update the positions and velocities of each particle based on the forces
-    for (int i = 0; i < N * N * N; i++) {
-        // Calculate the acceleration of each particle based on the forces acting on it
-        float ax = Fx_grav[i] / m[i] + Fx_em[i] / m[i] + Fx_weak[i] / m[i] + Fx_strong[i] / m[i];
-        float ay = Fy_grav[i] / m[i] + Fy_em[i] / m[i] + Fy_weak[i] / m[i] + Fy_strong[i] / m[i];
-        float az = Fz_grav[i] / m[i] + Fz_em[i] / m[i] + Fz_weak[i] / m[i] + Fz_strong[i] / m[i];
+bool CMBDataset::incremental_gravity() const {
+    return m_incremental && (m_gravity_solver == GravitySolver::Convolution || m_gravity_solver == GravitySolver::BruteForce);
+}
+
+bool CMBDataset::incremental_charges() const {
+    return m_incremental && (m_charge_solver == ChargeSolver::Convolution || m_charge_solver == ChargeSolver::Direct);
+}
 
-        // Update the velocity of each particle based on the acceleration
-        vx[i] += ax * dt;
-        vy[i] += ay * dt;
-        vz[i] += az * dt;
+void CMBDataset::set_sort_interval(int steps) {
+    particles.set_sort_interval(steps);
+}
 
-        // Update the position of each particle based on the velocity
-        x[i] += vx[i] * dt;
-        y[i] += vy[i] * dt;
-        z[i] += vz[i] * dt;
-    }
+void CMBDataset::set_thread_count(int count) {
+    default_thread_pool().resize(count);
 }
-private:
-    // Calculate gravity forces
-    void CMBDataset::calculate_gravity() {
-        // Calculate the forces on each cell in the dataset due to gravity
-        for (int i = 0; i < N * N * N; i++) {
-            Fg[i][0] = 0.0f;
-            Fg[i][1] = 0.0f;
-            Fg[i][2] = 0.0f;
-
-            for (int j = 0; j < N * N * N; j++) {
-                if (i == j) {
-                    continue;
-                }
-
-                float dx = (i % N - j % N) * h;
-                float dy = ((i / N) % N - (j / N) % N) * h;
-                float dz = (i / (N * N) - j / (N * N)) * h;
-
-                float r = sqrt(dx * dx + dy * dy + dz * dz);
-
-                // Calculate the force on each cell in the dataset due to gravity
-                float G = 6.67430e-11f; // Gravitational constant
-                float M = 4.0f / 3.0f * M_PI * pow(R, 3) * rho0; // Total mass of the sphere
-                float a = 1.0f + H * r - 0.5f * H * H * r * r; // Acceleration rate/inflation
-                float Fg_ij = G * M * rho[j] / r / r * a;
-
-                Fg[i][0] += Fg_ij * dx / r;
-                Fg[i][1] += Fg_ij * dy / r;
-                Fg[i][2] += Fg_ij * dz / r;
-            }
+
+int CMBDataset::thread_count() const {
+    return default_thread_pool().thread_count();
+}
+
+void CMBDataset::build_fields() {
+    // Inputs only change through initialize and randomize_charges, so their own nodes compute nothing
+    m_nodes.parameters = m_fields.add(nullptr);
+    m_nodes.temperature = m_fields.add([this] { compute_temperature(); });
+    m_nodes.density = m_fields.add([this] { compute_density(); });
+    m_fields.depend(m_nodes.density, m_nodes.parameters);
+    m_nodes.charges = m_fields.add([this] { compute_charges(); });
+    m_nodes.mass_table = m_fields.add([this] { compute_mass_table(); });
+    m_fields.depend(m_nodes.mass_table, m_nodes.density);
+    m_nodes.gravity_field = m_fields.add([this] { compute_gravity_field(); });
+    m_fields.depend(m_nodes.gravity_field, m_nodes.mass_table);
+    m_fields.depend(m_nodes.gravity_field, m_nodes.density);
+    m_nodes.particles = m_fields.add([this] { reset_particles(); });
+    m_fields.depend(m_nodes.particles, m_nodes.density);
+
+    m_nodes.initial_state = m_fields.add(nullptr);
+    DataflowGraph::Node initial[4] = { m_nodes.temperature, m_nodes.charges, m_nodes.gravity_field, m_nodes.particles };
+    for (int i = 0; i < 4; i++) {
+        m_fields.depend(m_nodes.initial_state, initial[i]);
+    }
+
+    // Forces the dataset does not evaluate keep their fields as they are
+    m_nodes.forces[0] = m_fields.add([this] {
+        if (m_enabled_forces & gravity_force) {
+            calculate_gravity();
+        }
+    });
+    m_fields.depend(m_nodes.forces[0], m_nodes.density);
+    m_nodes.forces[1] = m_fields.add([this] {
+        if (m_enabled_forces & electromagnetic_force) {
+            calculate_electromagnetism();
+        }
+    });
+    m_fields.depend(m_nodes.forces[1], m_nodes.charges);
+    m_nodes.forces[2] = m_fields.add([this] {
+        if (m_enabled_forces & weak_force) {
+            calculate_weak_nuclear();
         }
+    });
+    m_fields.depend(m_nodes.forces[2], m_nodes.charges);
+    m_fields.depend(m_nodes.forces[2], m_nodes.density);
+    m_nodes.forces[3] = m_fields.add([this] {
+        if (m_enabled_forces & strong_force) {
+            calculate_strong_nuclear();
+        }
+    });
+    m_fields.depend(m_nodes.forces[3], m_nodes.charges);
+
+    // The strong pass may share the charge solver's working state with the electromagnetic one, so it comes after
+    m_fields.depend(m_nodes.forces[3], m_nodes.forces[1]);
+
+    m_nodes.total = m_fields.add([this] { calculate_total_force(); });
+    for (int f = 0; f < 4; f++) {
+        m_fields.depend(m_nodes.total, m_nodes.forces[f]);
     }
+}
 
-    // Calculate electromagnetic forces
-    void CMBDataset::calculate_electromagnetism() {
-        float Fe_ij = k * q[i] * q[j] / r / r;
+void CMBDataset::mark_forces_current(unsigned forces) {
+    // A force calculated from inputs that are themselves out of date stays out of date
+    for (int f = 0; f < 4; f++) {
+        if (forces & (1u << f)) {
+            m_fields.validate(m_nodes.forces[f]);
+        }
+    }
+    m_fields.validate(m_nodes.total);
+}
 
-        Fe[i][0] += Fe_ij * dx / r;
-        Fe[i][1] += Fe_ij * dy / r;
-        Fe[i][2] += Fe_ij * dz / r;
+void CMBDataset::initialize(float inflation, float dark_matter, float dark_energy) {
+    if (inflation != m_inflation || dark_matter != m_dark_matter || dark_energy != m_dark_energy) {
+        m_inflation = inflation;
+        m_dark_matter = dark_matter;
+        m_dark_energy = dark_energy;
+        m_fields.invalidate(m_nodes.parameters);
     }
 
-    // Calculate weak nuclear forces
-    void CMBDataset::calculate_weak_nuclear() {
+    // The particles restart whether or not the density changed
+    m_fields.invalidate(m_nodes.particles);
+    m_fields.update(default_thread_pool(), m_nodes.initial_state);
 
-        // Calculate the force on each cell in the dataset due to weak nuclear force
-        float Fw_ij = 0.0f;
+    // Nodes run concurrently, so the integrator is only told once all of them are done
+    m_integrator.invalidate();
+}
 
-        // Calculate the exchange of W and Z bosons
-        float Wp = 1.0f / sqrt(2.0f);
-        float Wm = -1.0f / sqrt(2.0f);
-        float Z = 1.0f / sqrt(2.0f);
+void CMBDataset::refresh() {
+    // The convolution kernels are shared, so they are transformed before the passes that apply them
+    bool gravity_convolution = m_fields.dirty(m_nodes.forces[0]) && m_gravity_solver == GravitySolver::Convolution;
+    bool charge_convolution = (m_fields.dirty(m_nodes.forces[1]) || (m_fields.dirty(m_nodes.forces[3]) && !strong_is_short_range()))
+        && m_charge_solver == ChargeSolver::Convolution;
+    if (gravity_convolution || charge_convolution) {
+        prepare_convolutions();
+    }
 
-        float gL = 0.5f;
-        float gR = 0.0f;
+    if (m_fields.update(default_thread_pool()) > 0) {
+        // Accelerations kept by the integrator may have come from old particles or forces
+        m_integrator.invalidate();
+    }
+}
 
-        float sin_theta_W = 0.231f;
-        float cos_theta_W = sqrt(1.0f - sin_theta_W * sin_theta_W);
+void CMBDataset::randomize_charges() {
+    m_fields.invalidate(m_nodes.charges);
+}
 
-        float Vud = 0.974f;
-        float Vus = 0.225f;
-        float Vub = 0.004f;
-        float Vcd = 0.225f;
-        float Vcs = 0.973f;
-        float Vcb = 0.041f;
-        float Vtd = 0.009f;
-        float Vts = 0.040f;
-        float Vtb = 0.999f;
+void CMBDataset::compute_temperature() {
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // Set the temperature of each cell based on the cosmic microwave background radiation
+            float T0 = 2.7255f;
+            float deltaT = 0.001f * sin(i % m_n) * sin((i / m_n) % m_n) * sin(i / (m_n * m_n));
+            T[i] = T0 + deltaT;
+        }
+    });
+}
 
-        float u = 2.0f / 3.0f;
-        float d = -1.0f / 3.0f;
-        float s = -1.0f / 3.0f;
-        float c = 2.0f / 3.0f;
-        float b = -1.0f / 3.0f;
-        float t = 2.0f / 3.0f;
+void CMBDataset::compute_density() {
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // Set the density of each cell based on the distribution of matter and energy in the universe
+            float r = sqrt(pow((i % m_n) - m_n / 2, 2) + pow(((i / m_n) % m_n) - m_n / 2, 2) + pow((i / (m_n * m_n)) - m_n / 2, 2));
+            float density = m_dark_matter * exp(-r / 10.0f) + m_dark_energy * exp(r / 10.0f) + m_inflation;
+            rho[i] = density;
+        }
+    });
+}
 
-        float N = 3.0f * rho[i] / (4.0f * M_PI * pow(h, 3.0f));
+void CMBDataset::compute_charges() {
+    // Set the charge of each cell to random values
+    // rand() is neither thread-safe nor order-independent, so the charges are drawn on one thread in cell order
+    for (int i = 0; i < m_n * m_n * m_n; i++) {
+        // Set the charge of each cell to a random value between -1 and 1
+        q[i] = (float)rand() / RAND_MAX * 2.0f - 1.0f;
+    }
 
-        float E = 3.0f / 2.0f * T[i];
+    // Cancel out the charges as much as possible
+    // Calculate the total charge in the neighborhood of each cell; on the lattice r < 2h is the 26 surrounding cells
+    std::vector<StencilOffset> stencil = neighborhood_stencil(2.0f * h, h);
+    std::vector<float> total_charge(m_n * m_n * m_n);
+    stencil_sum(m_n, stencil, q, total_charge.data());
+
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // Adjust the charge of each cell to cancel out the total charge in its neighborhood
+            q[i] -= total_charge[i] / 26.0f;
+        }
+    });
+}
 
-        float Y_e = 0.5f;
+void CMBDataset::compute_mass_table() {
+    std::vector<float> mass(m_n * m_n * m_n);
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int j = begin; j < end; j++) {
+            mass[j] = rho[j] * h * h * h;
+        }
+    });
+    m_mass_table.build(m_n, mass.data());
+}
 
-        float gA = 1.27f;
+void CMBDataset::compute_gravity_field() {
+    // Adjust the gravity based on the distribution of dark matter structures
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // Calculate the total mass in the neighborhood of each cell, the 3x3x3 box without the cell itself
+            float mass = rho[i] * h * h * h;
+            float total_mass = (float)(m_mass_table.neighborhood_sum(i % m_n, (i / m_n) % m_n, i / (m_n * m_n), 1) - mass);
+
+            // Adjust the gravity of each cell based on the total mass in its neighborhood
+            float M = total_mass;
+            float r = h;
+            float F = G * M / (r * r);
+            float a = F / rho[i];
+            g[i] = a;
+        }
+    });
+}
 
-        float Fw_e = 0.0f;
-        float Fw_u = 0.0f;
-        float Fw_d = 0.0f;
+void CMBDataset::reset_particles() {
+    // One particle per cell, at rest at the cell center with the cell's mass
+    particles.resize(cell_count());
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            particles.x[i] = (i % m_n) * h;
+            particles.y[i] = ((i / m_n) % m_n) * h;
+            particles.z[i] = (i / (m_n * m_n)) * h;
+            particles.m[i] = rho[i] * h * h * h;
+        }
+    });
+    particles.update_inverse_mass();
+    particles.sort_by_cell();
+}
 
-        // Calculate the force on each cell in the dataset due to weak nuclear force
-        if (rho[i] > 0.0f && rho[j] > 0.0f) {
-            float Fw_eu = 0.0f;
-            float Fw_ed = 0.0f;
-            float Fw_ue = 0.0f;
-            float Fw_de = 0.0f;
+float CMBDataset::neighborhood_mass(int x, int y, int z, int radius) const {
+    return (float)m_mass_table.neighborhood_sum(x, y, z, radius);
+}
 
-            float Fw_uu = 0.0f;
-            float Fw_dd = 0.0f;
+void CMBDataset::prepare_convolutions() {
+    // Kernels only depend on the grid, so they are transformed once and reused by every step
+    if (m_gravity_convolution.prepared(m_n)) {
+        return;
+    }
 
-            float Fw_ee = 0.0f;
+    // Sampled from the shared offset tables; Coulomb and strong only differ by their coupling and share one
+    std::shared_ptr<const OffsetKernelTable> gravity = kernel_table_cache().table("gravity", m_n, h, gravity_kernel);
+    std::shared_ptr<const OffsetKernelTable> inverse_square =
+        kernel_table_cache().table("inverse square", m_n, h, inverse_square_kernel);
 
-            float Fw_eu_L = 0.0f;
-            float Fw_ed_L = 0.0f;
-            float Fw_ue_L = 0.0f;
-            float Fw_de_L = 0.0f;
+    m_gravity_convolution.prepare(m_n, 3, [&](int di, int dj, int dk, double* value) {
+        float sample[3];
+        sample_kernel(gravity.get(), di, dj, dk, h, gravity_kernel, sample);
+        for (int c = 0; c < 3; c++) {
+            value[c] = sample[c];
+        }
+    });
+    m_coulomb_convolution.prepare(m_n, 3, [&](int di, int dj, int dk, double* value) {
+        float sample[3];
+        sample_kernel(inverse_square.get(), di, dj, dk, h, inverse_square_kernel, sample);
+        for (int c = 0; c < 3; c++) {
+            value[c] = k_e * sample[c];
+        }
+    });
+    m_strong_convolution.prepare(m_n, 3, [&](int di, int dj, int dk, double* value) {
+        float sample[3];
+        sample_kernel(inverse_square.get(), di, dj, dk, h, inverse_square_kernel, sample);
+        for (int c = 0; c < 3; c++) {
+            value[c] = alpha_s * sample[c];
+        }
+    });
+}
 
-            float Fw_uu_L = 0.0f;
-            float Fw_dd_L = 0.0f;
+void CMBDataset::calculate_forces() {
+    calculate_forces(m_enabled_forces);
+}
 
-            float Fw_ee_L = 0.0f;
+void CMBDataset::calculate_forces(unsigned forces) {
+    // The four forces read rho, q and T and each write their own field, so they run as concurrent branches of a
+    // task graph; on small grids, where one pass cannot fill every core, the passes fill it together
+    TaskGraph graph;
 
-            float Fw_eu_R = 0.0f;
-            float Fw_ed_R = 0.0f;
-            float Fw_ue_R = 0.0f;
-            float Fw_de_R = 0.0f;
+    // Calculate the total force once every force is known
+    TaskGraph::Node total = graph.add([this] { calculate_total_force(); });
 
-            float Fw_uu_R = 0.0f;
-            float Fw_dd_R = 0.0f;
+    // Only the requested passes become tasks
+    const int none = -1;
+    TaskGraph::Node gravity = none;
+    TaskGraph::Node electromagnetism = none;
+    TaskGraph::Node strong = none;
 
-            float Fw_ee_R = 0.0f;
+    // Calculate gravity forces
+    if (forces & gravity_force) {
+        gravity = graph.add([this] { calculate_gravity(); });
+        graph.depend(total, gravity);
+    }
 
-            float Fw_eu_V = 0.0f;
-            float Fw_ed_V = 0.0f;
-            float Fw_ue_V = 0.0f;
-            float Fw_de_V = 0.0f;
+    // Calculate electromagnetic forces
+    if (forces & electromagnetic_force) {
+        electromagnetism = graph.add([this] { calculate_electromagnetism(); });
+        graph.depend(total, electromagnetism);
+    }
 
-            float Fw_uu_V = 0.0f;
-            float Fw_dd_V = 0.0f;
+    // Calculate weak nuclear forces
+    if (forces & weak_force) {
+        graph.depend(total, graph.add([this] { calculate_weak_nuclear(); }));
+    }
 
-            float Fw_ee_V = 0.0f;
+    // Calculate strong nuclear forces
+    if (forces & strong_force) {
+        strong = graph.add([this] { calculate_strong_nuclear(); });
+        graph.depend(total, strong);
+    }
 
-            float Fw_eu_A = 0.0f;
-            float Fw_ed_A = 0.0f;
-            float Fw_ue_A = 0.0f;
-            float Fw_de_A = 0.0f;
+    // The convolution kernels are shared, so they are transformed before any pass that applies them
+    bool long_range_strong = strong != none && !strong_is_short_range();
+    bool gravity_convolution = gravity != none && m_gravity_solver == GravitySolver::Convolution;
+    bool charge_convolution = (electromagnetism != none || long_range_strong) && m_charge_solver == ChargeSolver::Convolution;
+    if (gravity_convolution || charge_convolution) {
+        TaskGraph::Node prepare = graph.add([this] { prepare_convolutions(); });
+        TaskGraph::Node users[3] = { gravity, electromagnetism, long_range_strong ? strong : none };
+        for (int u = 0; u < 3; u++) {
+            if (users[u] != none) {
+                graph.depend(users[u], prepare);
+            }
+        }
+    }
 
-            float Fw_uu_A = 0.0f;
-            float Fw_dd_A = 0.0f;
+    // Both charge forces use one multipole solver, whose expansions are working state, or one incrementally
+    // updated electric field
+    bool shared_charge_state = m_charge_solver == ChargeSolver::FastMultipole || incremental_charges();
+    if (electromagnetism != none && long_range_strong && shared_charge_state) {
+        graph.depend(strong, electromagnetism);
+    }
 
-            float Fw_ee_A = 0.0f;
+    graph.run(default_thread_pool());
+    mark_forces_current(forces);
 
-            float Fw_eu_S = 0.0f;
-            float Fw_ed_S = 0.0f;
-            float Fw_ue_S = 0.0f;
-            float Fw_de_S = 0.0f;
+    // Accelerations kept by the integrator came from the old fields
+    m_integrator.invalidate();
+}
 
-            float Fw_uu_S = 0.0f;
-            float Fw_dd_S = 0.0f;
+void CMBDataset::calculate_total_force() {
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Fn.x[i] = Fg.x[i] + Fe.x[i] + Fw.x[i] + Fs.x[i];
+            Fn.y[i] = Fg.y[i] + Fe.y[i] + Fw.y[i] + Fs.y[i];
+            Fn.z[i] = Fg.z[i] + Fe.z[i] + Fw.z[i] + Fs.z[i];
+        }
+    });
+}
 
-            float Fw_ee_S = 0.0f;
+void CMBDataset::accelerate(ParticleStore& store, const int* active, int count) {
+    // Pairs depend on every position, so they are evaluated for all particles even when only some are stepped
+    bool pairs = particle_gravity_enabled();
+    if (pairs) {
+        calculate_particle_gravity(store);
+    }
 
-            float Fw_eu_T = 0.0f;
-            float Fw_ed_T = 0.0f;
-            float Fw_ue_T = 0.0f;
-            float Fw_de_T = 0.0f;
+    // Every particle takes the total force of the cell it is in
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int a = begin; a < end; a++) {
+            int k = active ? active[a] : a;
+            int c = store.cell_of(k);
+            float fx = Fn.x[c];
+            float fy = Fn.y[c];
+            float fz = Fn.z[c];
+            if (pairs) {
+                fx += m_particle_force.x[k];
+                fy += m_particle_force.y[k];
+                fz += m_particle_force.z[k];
+            }
+            store.ax[k] = fx * store.inv_m[k];
+            store.ay[k] = fy * store.inv_m[k];
+            store.az[k] = fz * store.inv_m[k];
+        }
+    });
+}
 
-            float Fw_uu_T = 0.0f;
-            float Fw_dd_T = 0.0f;
+void CMBDataset::calculate_particle_gravity(const ParticleStore& store) {
+    // The neighbor list is only rebuilt once a slot has moved more than half the skin since the last build; a sort
+    // moves particles between slots, which the list sees as such a move
+    int count = store.size();
+    if ((int)m_particle_force.size() != count) {
+        m_particle_force.resize(count);
+    }
+    m_particle_gravity.compute(count, store.x, store.y, store.z, store.m, nullptr, 1.0f / (h * h * h), m_particle_force);
+}
 
-            float Fw_ee_T = 0.0f;
-            // Calculate the exchange of W and Z bosons
-            float M_W = 80.379f;
-            float M_Z = 91.1876f;
-            float G_F = 1.1663787e-5f;
-            float sin2_theta_W = 0.231f;
-            float cos2_theta_W = 1.0f - sin2_theta_W;
-            float sin_theta_W = sqrt(sin2_theta_W);
-            float cos_theta_W = sqrt(cos2_theta_W);
+void CMBDataset::kick_particle_gravity(float dt) {
+    calculate_particle_gravity(particles);
+    parallel_for(0, particles.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            particles.vx[k] += dt * m_particle_force.x[k] * particles.inv_m[k];
+            particles.vy[k] += dt * m_particle_force.y[k] * particles.inv_m[k];
+            particles.vz[k] += dt * m_particle_force.z[k] * particles.inv_m[k];
+        }
+    });
+}
 
-            // Calculate the force on each cell in the dataset due to weak nuclear force
-            float Q_i = (1.0f - 4.0f * sin2_theta_W) * (2.0f * T3[i] - 4.0f * Q[i] * sin2_theta_W);
-            float Q_j = (1.0f - 4.0f * sin2_theta_W) * (2.0f * T3[j] - 4.0f * Q[j] * sin2_theta_W);
+void CMBDataset::update_grid() {
+    bool multiple = false;
+    for (int f = 0; f < 4; f++) {
+        multiple = multiple || m_force_interval[f] > 1;
+    }
+
+    if (multiple) {
+        step_multiple();
+    }
+    else {
+        // Update the positions and velocities of each particle based on the forces
+        m_integrator.step(particles, m_dt, [this](ParticleStore& store, const int* active, int count) {
+            accelerate(store, active, count);
+        });
+    }
+    m_step++;
+
+    // Restore the cell order of the particles every sort interval
+    particles.step();
+}
 
-            float V_ud = Vud * Vud;
-            float V_us = Vus * Vus;
-            float V_ub = Vub * Vub;
-            float V_cd = Vcd * Vcd;
-            float V_cs = Vcs * Vcs;
-            float V_cb = Vcb * Vcb;
-            float V_td = Vtd * Vtd;
-            float V_ts = Vts * Vts;
-            float V_tb = Vtb * Vtb;
+void CMBDataset::step_multiple() {
+    // A force with interval K acts as an impulse of K steps, half when its interval opens and half when it closes,
+    // where it is recalculated at the new positions; with every K = 1 this is kick-drift-kick leapfrog. Gravity
+    // between particles is the fastest force of all and kicks every step.
+    unsigned opening = 0;
+    unsigned closing = 0;
+    for (int f = 0; f < 4; f++) {
+        long long elapsed = m_step - m_force_start[f];
+        if (elapsed % m_force_interval[f] == 0) {
+            opening |= 1u << f;
+        }
+        if ((elapsed + 1) % m_force_interval[f] == 0) {
+            closing |= 1u << f;
+        }
+    }
 
-            float Fw_eu_L = -gL * (V_ud * Fw_dd_L + V_us * Fw_ds_L + V_ub * Fw_db_L + V_cd * Fw_ud_L + V_cs * Fw_us_L + V_cb * Fw_ub_L + V_td * Fw_td_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
-            float Fw_ed_L = -gL * (V_ud * Fw_ud_L + V_us * Fw_us_L + V_ub * Fw_ub_L + V_cd * Fw_dd_L + V_cs * Fw_ds_L + V_cb * Fw_db_L + V_td * Fw_td_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
-            float Fw_ue_L = -gL * (V_ud * Fw_uu_L + V_us * Fw_us_L + V_ub * Fw_ub_L + V_cd * Fw_cu_L + V_cs * Fw_cs_L + V_cb * Fw_cb_L + V_td * Fw_tu_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
-            float Fw_de_L = -gL * (V_ud * Fw_cu_L + V_us * Fw_cs_L + V_ub * Fw_cb_L + V_cd * Fw_dd_L + V_cs * Fw_ds_L + V_cb * Fw_db_L + V_td * Fw_td_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
+    apply_impulse(opening & m_enabled_forces);
+    if (particle_gravity_enabled()) {
+        kick_particle_gravity(0.5f * m_dt);
+    }
+    parallel_for(0, particles.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            particles.x[k] += particles.vx[k] * m_dt;
+            particles.y[k] += particles.vy[k] * m_dt;
+            particles.z[k] += particles.vz[k] * m_dt;
+        }
+    });
+    m_integrator.invalidate();
+    if (closing & m_enabled_forces) {
+        calculate_forces(closing & m_enabled_forces);
+        apply_impulse(closing & m_enabled_forces);
+    }
+    if (particle_gravity_enabled()) {
+        kick_particle_gravity(0.5f * m_dt);
+    }
 
-            float Fw_uu_L = -gL * (V_ud * Fw_ud_L + V_us * Fw_us_L + V_ub * Fw_ub_L + V_cd * Fw_uu_L + V_cs * Fw_cu_L + V_cb * Fw_tb_L + V_td * Fw_tu_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
-            float Fw_dd_L = -gL * (V_ud * Fw_dd_L + V_us * Fw_ds_L + V_ub * Fw_db_L + V_cd * Fw_dd_L + V_cs * Fw_cd_L + V_cb * Fw_sb_L + V_td * Fw_td_L + V_ts * Fw_ts_L + V_tb * Fw_tb_L);
+    // Intervals set while open take over once they close, counting from the next step
+    for (int f = 0; f < 4; f++) {
+        if ((closing & (1u << f)) && m_next_interval[f] != m_force_interval[f]) {
+            m_force_interval[f] = m_next_interval[f];
+            m_force_start[f] = m_step + 1;
+        }
+    }
+}
 
-            float Fw_ee_L = -gL * (Fw_eu_L + Fw_ed_L);
+void CMBDataset::apply_impulse(unsigned forces) {
+    const VectorField* fields[4] = { &Fg, &Fe, &Fw, &Fs };
+    const VectorField* active[4];
+    float weight[4];
+    int count = 0;
+    for (int f = 0; f < 4; f++) {
+        if (forces & (1u << f)) {
+            active[count] = fields[f];
+            weight[count] = 0.5f * m_force_interval[f] * m_dt;
+            count++;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
 
-            float Fw_eu_R = -gR * (V_ud * Fw_dd_R + V_us * Fw_ds_R + V_ub * Fw_db_R + V_cd * Fw_ud_R + V_cs * Fw_us_R + V_cb * Fw_ub_R + V_td * Fw_td_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
-            float Fw_ed_R = -gR * (V_ud * Fw_ud_R + V_us * Fw_us_R + V_ub * Fw_ub_R + V_cd * Fw_dd_R + V_cs * Fw_ds_R + V_cb * Fw_db_R + V_td * Fw_td_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
-            float Fw_ue_R = -gR * (V_ud * Fw_uu_R + V_us * Fw_us_R + V_ub * Fw_ub_R + V_cd * Fw_cu_R + V_cs * Fw_cs_R + V_cb * Fw_cb_R + V_td * Fw_tu_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
-            float Fw_de_R = -gR * (V_ud * Fw_cu_R + V_us * Fw_cs_R + V_ub * Fw_cb_R + V_cd * Fw_dd_R + V_cs * Fw_ds_R + V_cb * Fw_db_R + V_td * Fw_td_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
+    // Every particle takes the forces of the cell it is in
+    parallel_for(0, particles.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            int c = particles.cell_of(k);
+            float jx = 0.0f;
+            float jy = 0.0f;
+            float jz = 0.0f;
+            for (int f = 0; f < count; f++) {
+                jx += weight[f] * active[f]->x[c];
+                jy += weight[f] * active[f]->y[c];
+                jz += weight[f] * active[f]->z[c];
+            }
+            particles.vx[k] += jx * particles.inv_m[k];
+            particles.vy[k] += jy * particles.inv_m[k];
+            particles.vz[k] += jz * particles.inv_m[k];
+        }
+    });
+}
 
-            float Fw_uu_R = -gR * (V_ud * Fw_ud_R + V_us * Fw_us_R + V_ub * Fw_ub_R + V_cd * Fw_uu_R + V_cs * Fw_cu_R + V_cb * Fw_tb_R + V_td * Fw_tu_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
-            float Fw_dd_R = -gR * (V_ud * Fw_dd_R + V_us * Fw_ds_R + V_ub * Fw_db_R + V_cd * Fw_dd_R + V_cs * Fw_cd_R + V_cb * Fw_sb_R + V_td * Fw_td_R + V_ts * Fw_ts_R + V_tb * Fw_tb_R);
+// Calculate gravity forces
+void CMBDataset::calculate_gravity() {
+    if (incremental_gravity()) {
+        // Fg is linear in rho, so only the cells whose density moved change it, by their change times the kernel
+        int cells = cell_count();
+        int dirty = m_rho_changes.tracking() ? m_rho_changes.scan(rho) : cells;
+        if (m_rho_changes.tracking() && dirty <= m_max_dirty_fraction * cells) {
+            if (dirty > 0) {
+                std::shared_ptr<const OffsetKernelTable> gravity = kernel_table_cache().table("gravity", m_n, h, gravity_kernel);
+                add_source_changes(m_n, h, gravity.get(), gravity_kernel, dirty, m_rho_changes.dirty(),
+                    m_rho_changes.delta(), 1.0f, Fg);
+                m_rho_changes.commit(rho);
+            }
+            return;
+        }
 
-            float Fw_ee_R = -gR * (Fw_eu_R + Fw_ed_R);
+        // Too much changed to beat a full pass, which then starts the tracking from the current densities
+        m_rho_changes.reset(cells, rho);
+    }
 
-            float Fw_eu_V = -2.0f * gL * gR * (V_ud * Fw_dd_V + V_us * Fw_ds_V + V_ub * Fw_db_V + V_cd * Fw_ud_V + V_cs * Fw_us_V + V_cb * Fw_ub_V + V_td * Fw_td_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
-            float Fw_ed_V = -2.0f * gL * gR * (V_ud * Fw_ud_V + V_us * Fw_us_V + V_ub * Fw_ub_V + V_cd * Fw_dd_V + V_cs * Fw_ds_V + V_cb * Fw_db_V + V_td * Fw_td_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
-            float Fw_ue_V = -2.0f * gL * gR * (V_ud * Fw_uu_V + V_us * Fw_us_V + V_ub * Fw_ub_V + V_cd * Fw_cu_V + V_cs * Fw_cs_V + V_cb * Fw_cb_V + V_td * Fw_tu_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
-            float Fw_de_V = -2.0f * gL * gR * (V_ud * Fw_cu_V + V_us * Fw_cs_V + V_ub * Fw_cb_V + V_cd * Fw_dd_V + V_cs * Fw_ds_V + V_cb * Fw_db_V + V_td * Fw_td_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
+    if (m_gravity_solver == GravitySolver::BarnesHut) {
+        // Approximate distant groups of cells by their center of mass
+        m_barnes_hut.build(m_n, h, rho);
+        m_barnes_hut.compute(Fg);
+        return;
+    }
 
-            float Fw_uu_V = -2.0f * gL * gR * (V_ud * Fw_ud_V + V_us * Fw_us_V + V_ub * Fw_ub_V + V_cd * Fw_uu_V + V_cs * Fw_cu_V + V_cb * Fw_tb_V + V_td * Fw_tu_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
-            float Fw_dd_V = -2.0f * gL * gR * (V_ud * Fw_dd_V + V_us * Fw_ds_V + V_ub * Fw_db_V + V_cd * Fw_dd_V + V_cs * Fw_cd_V + V_cb * Fw_sb_V + V_td * Fw_td_V + V_ts * Fw_ts_V + V_tb * Fw_tb_V);
+    if (m_gravity_solver == GravitySolver::Convolution) {
+        // Exact sum over all pairs as an FFT convolution of rho with the gravity kernel
+        prepare_convolutions();
+        float* streams[3] = { Fg.x, Fg.y, Fg.z };
+        m_gravity_convolution.apply(rho, streams);
+        return;
+    }
 
-            float Fw_ee_V = -2.0f * gL * gR * (Fw_eu_V + Fw_ed_V);
+    if (m_gravity_solver == GravitySolver::FastMultipole) {
+        m_gravity_multipole.compute(m_n, h, rho, nullptr, 1.0f, Fg);
+        return;
+    }
 
-            float Fw_eu = Fw_eu_L + Fw_eu_R + Fw_eu_V;
-            float Fw_ed = Fw_ed_L + Fw_ed_R + Fw_ed_V;
-            float Fw_ue = Fw_ue_L + Fw_ue_R + Fw_ue_V;
-            float Fw_de = Fw_de_L + Fw_de_R + Fw_de_V;
-            float Fw_uu = Fw_uu_L + Fw_uu_R + Fw_uu_V;
-            float Fw_dd = Fw_dd_L + Fw_dd_R + Fw_dd_V;
-            float Fw_ee = Fw_ee_L + Fw_ee_R + Fw_ee_V;
+    if (m_gravity_solver == GravitySolver::ParticleMesh) {
+        // Solve for the potential of rho on the cell lattice and take its gradient
+        m_particle_mesh.compute(m_n, h, rho, Fg);
+        return;
+    }
 
-            // Calculate the force on each cell in the dataset due to weak nuclear force and strong nuclear force
-            Fw[i][0] += Fw_eu + Fw_ue;
-            Fw[j][0] += Fw_ed + Fw_de;
+    // Calculate the forces on each cell in the dataset due to gravity
+    m_gravity_pairs.compute(m_n, h, rho, nullptr, 1.0f, Fg);
+}
 
-            Fw[i][1] += Fw_eu + Fw_ue;
-            Fw[j][1] += Fw_ed + Fw_de;
+// Calculate electromagnetic forces
+void CMBDataset::calculate_electromagnetism() {
+    if (incremental_charges()) {
+        update_electric_field();
+        parallel_for(0, cell_count(), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                Fe.set(i, q[i] * m_electric_field.x[i], q[i] * m_electric_field.y[i], q[i] * m_electric_field.z[i]);
+            }
+        });
+        return;
+    }
 
-            Fw[i][2] += Fw_eu + Fw_ue;
-            Fw[j][2] += Fw_ed + Fw_de;
+    if (m_charge_solver == ChargeSolver::FastMultipole) {
+        m_charge_multipole.compute(m_n, h, q, q, k_e, Fe);
+        return;
+    }
 
-            // Calculate the force on each cell in the dataset due to the total nuclear force
-            Fn[i][0] = Fg[i][0] + Fe[i][0] + Fw[i][0] + Fs[i][0];
-            Fn[j][0] = Fg[j][0] + Fe[j][0] + Fw[j][0] + Fs[j][0];
+    if (m_charge_solver == ChargeSolver::Direct) {
+        m_coulomb_pairs.compute(m_n, h, q, q, k_e, Fe);
+        return;
+    }
 
-            Fn[i][1] = Fg[i][1] + Fe[i][1] + Fw[i][1] + Fs[i][1];
-            Fn[j][1] = Fg[j][1] + Fe[j][1] + Fw[j][1] + Fs[j][1];
+    prepare_convolutions();
 
-            Fn[i][2] = Fg[i][2] + Fe[i][2] + Fw[i][2] + Fs[i][2];
-            Fn[j][2] = Fg[j][2] + Fe[j][2] + Fw[j][2] + Fs[j][2];
+    // Fe[i] = k * q[i] * sum of q[j] * (x[i] - x[j]) / r^3
+    float* streams[3] = { Fe.x, Fe.y, Fe.z };
+    m_coulomb_convolution.apply(q, streams);
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Fe.scale(i, q[i]);
         }
-    }
+    });
+}
+
+// Calculate weak nuclear forces
+void CMBDataset::calculate_weak_nuclear() {
+    // Matter is taken as electrons, weak isospin -1/2, carrying the charge of the cell
+    weak_charges(cell_count(), electron.T3, q, rho, m_weak_charge);
+
+    // Z exchange is short ranged, so each unordered pair within the cutoff is visited once from its first cell
+    // and the force is added to both cells with opposite signs
+    int reach = (int)ceil(weak_cutoff / h);
+    m_weak_scatter.run(m_n, reach, Fw, [&](const CellBox& box, VectorField& out) {
+        weak_stencil_forces(m_n, box, m_weak_stencil.data(), m_weak_table.data(), (int)m_weak_stencil.size(),
+            m_weak_charge, out);
+    });
+}
 
 // Calculate strong nuclear forces
-    void CMBDataset::CMBDataset::calculate_strong_nuclear() {
-        // Calculate the forces on each cell in the dataset due to the strong nuclear force
-        for (int i = 0; i < N * N * N; i++) {
-            Fs[i][0] = 0.0f;
-            Fs[i][1] = 0.0f;
-            Fs[i][2] = 0.0f;
-
-            for (int j = 0; j < N * N * N; j++) {
-                if (i == j) {
-                    continue;
-                }
-
-                float dx = (i % N - j % N) * h;
-                float dy = ((i / N) % N - (j / N) % N) * h;
-                float dz = (i / (N * N) - j / (N * N)) * h;
-
-                float r = sqrt(dx * dx + dy * dy + dz * dz);
-
-                // Calculate the force on each cell in the dataset due to the exchange of gluons
-                float alpha_s = 0.118f; // Strong coupling constant
-                float Fg_ij = alpha_s * q[i] * q[j] / r / r;
-
-                Fs[i][0] += Fg_ij * dx / r;
-                Fs[i][1] += Fg_ij * dy / r;
-                Fs[i][2] += Fg_ij * dz / r;
+void CMBDataset::calculate_strong_nuclear() {
+    if (strong_is_short_range()) {
+        // Only pairs within the cutoff, enumerated through the cell list
+        m_strong_short_range.compute(m_n, h, q, q, alpha_s, Fs);
+        return;
+    }
+
+    if (incremental_charges()) {
+        // The strong force has the Coulomb kernel with alpha_s for k_e
+        update_electric_field();
+        float coupling = alpha_s / k_e;
+        parallel_for(0, cell_count(), [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                float scale = coupling * q[i];
+                Fs.set(i, scale * m_electric_field.x[i], scale * m_electric_field.y[i], scale * m_electric_field.z[i]);
             }
+        });
+        return;
+    }
+
+    if (m_charge_solver == ChargeSolver::FastMultipole) {
+        m_charge_multipole.compute(m_n, h, q, q, alpha_s, Fs);
+        return;
+    }
+
+    if (m_charge_solver == ChargeSolver::Direct) {
+        m_strong_pairs.compute(m_n, h, q, q, alpha_s, Fs);
+        return;
+    }
+
+    prepare_convolutions();
+
+    // Calculate the forces on each cell in the dataset due to the exchange of gluons
+    float* streams[3] = { Fs.x, Fs.y, Fs.z };
+    m_strong_convolution.apply(q, streams);
+    parallel_for(0, cell_count(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Fs.scale(i, q[i]);
         }
+    });
+}
+
+// Bring the electric field up to date with q; the second charge pass of a step finds nothing left to apply
+void CMBDataset::update_electric_field() {
+    // The field is linear in q, though the forces, q[i] times the field, are not
+    int cells = cell_count();
+    int dirty = m_q_changes.tracking() ? m_q_changes.scan(q) : cells;
+    if (m_q_changes.tracking() && dirty <= m_max_dirty_fraction * cells) {
+        if (dirty > 0) {
+            std::shared_ptr<const OffsetKernelTable> inverse_square =
+                kernel_table_cache().table("inverse square", m_n, h, inverse_square_kernel);
+            add_source_changes(m_n, h, inverse_square.get(), inverse_square_kernel, dirty, m_q_changes.dirty(),
+                m_q_changes.delta(), k_e, m_electric_field);
+            m_q_changes.commit(q);
+        }
+        return;
     }
+
+    m_q_changes.reset(cells, q);
+    if (m_charge_solver == ChargeSolver::Direct) {
+        m_coulomb_pairs.compute(m_n, h, q, nullptr, k_e, m_electric_field);
+        return;
     }
-;
+
+    prepare_convolutions();
+    float* streams[3] = { m_electric_field.x, m_electric_field.y, m_electric_field.z };
+    m_coulomb_convolution.apply(q, streams);
+}
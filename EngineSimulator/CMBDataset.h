@@ -2,28 +2,260 @@
 
 #include <DirectXMath.h>
 
+#include "BarnesHut.h"
+#include "ChangeTracker.h"
+#include "DataflowGraph.h"
+#include "FastMultipole.h"
+#include "FieldStorage.h"
+#include "GridConvolution.h"
+#include "Integrator.h"
+#include "Neighborhood.h"
+#include "PairKernels.h"
+#include "ParticleStore.h"
+#include "ScatterAccumulator.h"
+#include "ShortRange.h"
+#include "TaskGraph.h"
+#include "ParticleMesh.h"
+
 using namespace DirectX;
 
-const int N = 10; // Number of cells in each dimension
-const float h = 1.0f; // Spacing between cells
-const float rho_init = 1.0f; // Initial density
-const float T_init = 2.7f; // Initial temperature
-const float gamma_init = 1.4f; // Initial adiabatic index
-const float G = 6.67430e-11f; // Gravitational constant
+constexpr int N_init = 10; // Default number of cells in each dimension
+constexpr float h = 1.0f; // Spacing between cells
+constexpr float rho_init = 1.0f; // Initial density
+constexpr float T_init = 2.7f; // Initial temperature
+constexpr float gamma_init = 1.4f; // Initial adiabatic index
+constexpr float G = 6.67430e-11f; // Gravitational constant
+constexpr float R = 1.0f; // Radius of the sphere each cell's mass is spread over
+constexpr float rho0 = rho_init; // Reference density of the sphere
+constexpr float H = 0.01f; // Expansion rate used for the inflation correction
+constexpr float dt_init = 0.01f; // Default time step of update_grid
+constexpr float inflation_init = 1.0f; // Parameters the constructor initializes the fields with
+constexpr float dark_matter_init = 18.0f;
+constexpr float dark_energy_init = 4.0e9f;
+
+// The forces of the dataset, combined with |
+constexpr unsigned gravity_force = 1u << 0;
+constexpr unsigned electromagnetic_force = 1u << 1;
+constexpr unsigned weak_force = 1u << 2;
+constexpr unsigned strong_force = 1u << 3;
+constexpr unsigned all_forces = gravity_force | electromagnetic_force | weak_force | strong_force;
+
+// Algorithms available to calculate_gravity
+enum class GravitySolver {
+    BruteForce,   // Exact all-pairs sum with the vectorized pair kernels, O(M^2) in cell count
+    Convolution,  // Exact all-pairs sum as a zero-padded FFT convolution, O(M log M)
+    BarnesHut,    // Octree approximation controlled by an opening angle, O(M log M)
+    ParticleMesh, // FFT Poisson solve on the cell lattice, O(M log M)
+    FastMultipole // Chebyshev fast multipole method with a configurable order, O(M)
+};
+
+// Algorithms available to the charge-driven electromagnetic and strong forces
+enum class ChargeSolver {
+    Direct,       // Exact all-pairs sum with the vectorized pair kernels, O(M^2)
+    Convolution,  // Exact all-pairs sum as a zero-padded FFT convolution, O(M log M)
+    FastMultipole // Chebyshev fast multipole method with a configurable order, O(M)
+};
 
 class CMBDataset {
 public:
-    CMBDataset();
+    explicit CMBDataset(int n = N_init);
+    virtual ~CMBDataset() {}
+
+    // Set up the fields for the given parameters. Derived fields are kept in a dataflow graph, so calling it again
+    // only recomputes what the changed parameters reach: rho, the neighborhood masses, g and the particles, while
+    // T and the charges are kept. The particles always restart from the cell centers.
     void initialize(float inflation, float dark_matter, float dark_energy);
     void calculate_forces();
+
+    // Bring every derived field up to date with the parameters, the charges and the solver settings, the forces
+    // included, recomputing only the out of date ones; fields written directly are not tracked
+    void refresh();
+
+    // Draw new random charges, cancelled against their neighborhoods, on the next initialize or refresh
+    void randomize_charges();
+
+    // Derived fields computed by initialize and refresh so far, for checks
+    long long fields_computed() const { return m_fields.computed(); }
     void update_grid();
+    void set_gravity_solver(GravitySolver solver, float opening_angle = 0.5f);
+    void set_particle_mesh(PoissonBoundary boundary, GradientMethod gradient);
+    void set_charge_solver(ChargeSolver solver);
+    void set_multipole_order(int order);
+
+    // Whether the brute-force gravity and the direct charge forces evaluate each pair once or in both orders
+    void set_pair_traversal(PairTraversal traversal);
+
+    // Limit the strong force to pairs closer than cutoff, found through a cell list, with the potential switched
+    // smoothly to zero from switch_on (negative for a hard cutoff); a cutoff of 0 restores the all-pairs charge solver
+    void set_strong_cutoff(float cutoff, float switch_on = -1.0f);
+
+    // Add the gravity between particles closer than cutoff to the force of their cells, with each particle's mass
+    // spread over a cell as rho is and the potential switched to zero from switch_on as for the strong cutoff. The
+    // pairs come from a Verlet list over cutoff + skin that update_grid only rebuilds once some particle has moved
+    // more than skin / 2, so a skin of 0 bins the particles every step; a cutoff of 0 turns the pairs off.
+    void set_particle_gravity(float cutoff, float skin, float switch_on = -1.0f);
+    const VerletList& particle_neighbors() const { return m_particle_gravity.neighbor_list(); }
+
+    // How the weak pass, which writes to both cells of a pair, splits its writes between threads
+    void set_weak_scatter(ScatterSchedule schedule);
+
+    // Time step update_grid advances the particles by
+    void set_time_step(float dt);
+    float time_step() const { return m_dt; }
+
+    // Scheme update_grid integrates with, Euler by default as before; leapfrog holds the same accuracy at several
+    // times the step of Euler, and block steps need it. Returns false and keeps the scheme when asked for Euler
+    // while a force interval is above 1.
+    bool set_integrator(Integrator scheme);
+    Integrator integrator() const { return m_integrator.scheme(); }
+
+    // Split each step into up to 2^depth substeps, with every particle taking the power-of-two share of the step
+    // its acceleration allows, sqrt(2 step_length / |a|); a depth of 0 steps every particle at once. Returns false
+    // and changes nothing when asked for a depth above 0 while a force interval is above 1.
+    bool set_block_steps(int depth, float step_length = 0.01f * h);
+
+    // Multiple time stepping (r-RESPA): recalculate the given forces only every steps calls of update_grid, with
+    // the impulse of steps time steps split between the two ends of that interval. While any force has an interval
+    // above 1, update_grid recalculates each force when its interval ends instead of using the fields as they are,
+    // so the slow long-range forces can run a fraction as often as the fast short-range ones.
+    // The intervals count from the step they were set on. A force whose interval is open keeps it until it closes
+    // and takes the new one from the next step. r-RESPA is a leapfrog scheme with its own kicks, so it takes the
+    // place of the integrator: intervals above 1 need the leapfrog integrator without block steps, and otherwise
+    // set_force_interval returns false and changes nothing.
+    bool set_force_interval(unsigned forces, int steps);
+    int force_interval(unsigned force) const;
+
+    // Kinetic energy of the particles, for energy drift reports
+    double kinetic_energy() const;
+
+    // Update the exact long-range forces (convolution or all-pairs gravity and charge forces) from the cells whose rho
+    // or q moved by more than tolerance since they were last applied, adding only those cells' change in contribution;
+    // once more than max_dirty_fraction of the cells changed, the forces are recalculated in full instead.
+    // Changes below the tolerance are carried until they add up past it. Approximate solvers always run in full.
+    void set_incremental(bool enabled, float tolerance = 0.0f, float max_dirty_fraction = 0.02f);
+    bool incremental() const { return m_incremental; }
+
+    // Steps between reorderings of the particles by cell, 0 to keep their order
+    void set_sort_interval(int steps);
+
+    // Threads every force pass and update runs on, 0 for one per hardware thread; the pool is kept between steps
+    void set_thread_count(int count);
+    int thread_count() const;
+
+    // Number of cells in each dimension and in the whole grid
+    int dimension() const { return m_n; }
+    int cell_count() const { return m_n * m_n * m_n; }
+
+    // Memory held by the offset kernel tables the force passes share, bounded by kernel_table_cache()
+    size_t kernel_table_bytes() const;
+
+    // Mass within radius cells of (x, y, z) in each dimension, answered from the table built by initialize
+    float neighborhood_mass(int x, int y, int z, int radius) const;
+
+    ScalarField rho;
+    ScalarField T;
+    ScalarField gamma;
+    ScalarField q;
+    ScalarField g;
+    VectorField Fg;
+    VectorField Fe;
+    VectorField Fw;
+    VectorField Fs;
+    VectorField Fn;
+
+    // Matter of every cell as a particle that starts at the cell center and moves with the force of the cell it is in
+    ParticleStore particles;
+
+protected:
+    // Passes a preset may specialize; every force evaluation goes through them
+    virtual void calculate_forces(unsigned forces);
+    void step_multiple();
+    bool multiple_time_stepping() const;
+    void apply_impulse(unsigned forces);
+    void calculate_gravity();
+    void calculate_electromagnetism();
+    virtual void calculate_weak_nuclear();
+    void calculate_strong_nuclear();
+    virtual void calculate_total_force();
+    void prepare_convolutions();
+    void build_fields();
+    void mark_forces_current(unsigned forces);
+    void compute_temperature();
+    void compute_density();
+    void compute_charges();
+    void compute_mass_table();
+    void compute_gravity_field();
+    void reset_particles();
+    void accelerate(ParticleStore& store, const int* active, int count);
+    void calculate_particle_gravity(const ParticleStore& store);
+    void kick_particle_gravity(float dt);
+    bool particle_gravity_enabled() const { return m_particle_cutoff > 0.0f; }
+    bool strong_is_short_range() const { return m_strong_cutoff > 0.0f; }
+    bool incremental_gravity() const;
+    bool incremental_charges() const;
+    void update_electric_field();
+
+    int m_n;
+    float m_dt;
+    ParticleIntegrator m_integrator;
+    unsigned m_enabled_forces;  // Forces a derived dataset evaluates at all
+    int m_force_interval[4];    // Steps between recalculations of each force, in flag bit order
+    long long m_force_start[4]; // Step the current interval of each force counts from
+    int m_next_interval[4];     // Interval each force takes once its open interval closes
+    long long m_step;           // Calls of update_grid so far
+    GravitySolver m_gravity_solver;
+    BarnesHutSolver m_barnes_hut;
+    ParticleMeshSolver m_particle_mesh;
+    ChargeSolver m_charge_solver;
+    FastMultipoleSolver m_gravity_multipole;
+    FastMultipoleSolver m_charge_multipole;
+    PairForceSolver m_gravity_pairs;
+    PairForceSolver m_coulomb_pairs;
+    PairForceSolver m_strong_pairs;
+    ShortRangeSolver m_strong_short_range;
+    float m_strong_cutoff;
+    ShortRangeSolver m_particle_gravity;
+    float m_particle_cutoff;
+    VectorField m_particle_force; // Pair gravity on every particle slot, in the units of Fn
+
+    // Incremental updates: rho and q as last applied to the forces, and the Coulomb force per unit charge on every
+    // cell, k_e * sum of q[j] * K(i - j), which the electromagnetic and strong forces scale by q[i]
+    bool m_incremental;
+    float m_max_dirty_fraction;
+    ChangeTracker m_rho_changes;
+    ChangeTracker m_q_changes;
+    VectorField m_electric_field;
+
+    // Pairwise kernels on the grid, transformed once per grid size
+    GridConvolution m_gravity_convolution;
+    GridConvolution m_coulomb_convolution;
+    GridConvolution m_strong_convolution;
+
+    // Weak charge of every cell and the half stencil of the weak force with its force per offset
+    ScalarField m_weak_charge;
+    std::vector<StencilOffset> m_weak_stencil;
+    std::vector<float> m_weak_table;
+    ScatterAccumulator m_weak_scatter;
+
+    // Prefix sums of the cell masses for box-neighborhood queries
+    SummedVolumeTable m_mass_table;
 
-    float rho[N * N * N];
-    float T[N * N * N];
-    float gamma[N * N * N];
-    float Fg[N * N * N][3];
-    float Fe[N * N * N][3];
-    float Fw[N * N * N][3];
-    float Fs[N * N * N][3];
-    float Fn[N * N * N][3];
+    // Derived fields and the inputs they are computed from
+    struct FieldNodes {
+        DataflowGraph::Node parameters;
+        DataflowGraph::Node temperature;
+        DataflowGraph::Node density;
+        DataflowGraph::Node charges;
+        DataflowGraph::Node mass_table;
+        DataflowGraph::Node gravity_field;
+        DataflowGraph::Node particles;
+        DataflowGraph::Node initial_state; // Everything initialize sets up
+        DataflowGraph::Node forces[4];     // Fg, Fe, Fw and Fs, in flag bit order
+        DataflowGraph::Node total;
+    };
+    DataflowGraph m_fields;
+    FieldNodes m_nodes;
+    float m_inflation;
+    float m_dark_matter;
+    float m_dark_energy;
 };
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "CacheInfo.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <vector>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    CacheSizes detect_cache_sizes() {
+        CacheSizes sizes = { 0, 0, 0 };
+
+#ifdef _WIN32
+        // Data and unified caches of every level; a level reported several times (once per core) keeps one size
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(RelationCache, nullptr, &length);
+        std::vector<char> buffer(length);
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data());
+        if (length > 0 && GetLogicalProcessorInformationEx(RelationCache, info, &length)) {
+            for (DWORD offset = 0; offset < length; ) {
+                PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX entry =
+                    reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+                const CACHE_RELATIONSHIP& cache = entry->Cache;
+                if (cache.Type == CacheData || cache.Type == CacheUnified) {
+                    size_t* level = cache.Level == 1 ? &sizes.l1 : cache.Level == 2 ? &sizes.l2 : cache.Level == 3 ? &sizes.l3 : nullptr;
+                    if (level) {
+                        *level = cache.CacheSize;
+                    }
+                }
+                offset += entry->Size;
+            }
+        }
+#elif defined(_SC_LEVEL1_DCACHE_SIZE)
+        long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+        long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        sizes.l1 = l1 > 0 ? (size_t)l1 : 0;
+        sizes.l2 = l2 > 0 ? (size_t)l2 : 0;
+        sizes.l3 = l3 > 0 ? (size_t)l3 : 0;
+#endif
+
+        if (sizes.l1 == 0) {
+            sizes.l1 = 32u << 10;
+        }
+        if (sizes.l2 == 0) {
+            sizes.l2 = 256u << 10;
+        }
+        if (sizes.l3 == 0) {
+            sizes.l3 = 8u << 20;
+        }
+        return sizes;
+    }
+}
+
+const CacheSizes& cache_sizes() {
+    static CacheSizes sizes = detect_cache_sizes();
+    return sizes;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// Data cache sizes seen by one core, in bytes. Levels the platform does not report fall back to common sizes
+// (32 KB, 256 KB and 8 MB), so tile sizes derived from them stay reasonable everywhere.
+struct CacheSizes {
+    size_t l1;
+    size_t l2;
+    size_t l3;
+};
+
+// Sizes detected on first use and reused afterwards
+const CacheSizes& cache_sizes();
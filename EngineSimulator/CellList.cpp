@@ -0,0 +1,69 @@
+#include "CellList.h"
+
+#include <algorithm>
+#include <cmath>
+
+CellList::CellList() :
+    m_dimension(1),
+    m_size(1.0f)
+{
+    m_origin[0] = 0.0f;
+    m_origin[1] = 0.0f;
+    m_origin[2] = 0.0f;
+    m_start.assign(2, 0);
+}
+
+int CellList::coordinate(float v, float origin) const {
+    int b = (int)((v - origin) / m_size);
+    return std::min(m_dimension - 1, std::max(0, b));
+}
+
+int CellList::bucket_of(float x, float y, float z) const {
+    return bucket(coordinate(x, m_origin[0]), coordinate(y, m_origin[1]), coordinate(z, m_origin[2]));
+}
+
+void CellList::build(int count, const float* x, const float* y, const float* z, float cell_size) {
+    float lo[3] = { 0.0f, 0.0f, 0.0f };
+    float hi[3] = { 0.0f, 0.0f, 0.0f };
+    if (count > 0) {
+        lo[0] = hi[0] = x[0];
+        lo[1] = hi[1] = y[0];
+        lo[2] = hi[2] = z[0];
+    }
+    for (int i = 1; i < count; i++) {
+        lo[0] = std::min(lo[0], x[i]);
+        hi[0] = std::max(hi[0], x[i]);
+        lo[1] = std::min(lo[1], y[i]);
+        hi[1] = std::max(hi[1], y[i]);
+        lo[2] = std::min(lo[2], z[i]);
+        hi[2] = std::max(hi[2], z[i]);
+    }
+
+    // Buckets may be wider than cell_size but never narrower; their number is kept to about two per point so
+    // sparse point sets do not allocate empty space
+    float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    int by_size = cell_size > 0.0f ? (int)(extent / cell_size) : 1;
+    int by_count = (int)cbrt(2.0 * count) + 1;
+    m_dimension = std::max(1, std::min(by_size, by_count));
+    m_size = std::max(cell_size, extent / m_dimension);
+    for (int d = 0; d < 3; d++) {
+        m_origin[d] = lo[d];
+    }
+
+    // Counting sort: bucket sizes, their prefix sums, then every point dropped into its slot in input order
+    std::vector<int> bucket_of_point(count);
+    m_start.assign(bucket_count() + 1, 0);
+    for (int i = 0; i < count; i++) {
+        bucket_of_point[i] = bucket_of(x[i], y[i], z[i]);
+        m_start[bucket_of_point[i] + 1]++;
+    }
+    for (int b = 0; b < bucket_count(); b++) {
+        m_start[b + 1] += m_start[b];
+    }
+
+    m_order.resize(count);
+    std::vector<int> fill(m_start.begin(), m_start.end() - 1);
+    for (int i = 0; i < count; i++) {
+        m_order[fill[bucket_of_point[i]]++] = i;
+    }
+}
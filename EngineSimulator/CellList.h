@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+// Points binned into a cube of cubic buckets at least cell_size wide, stored in CSR form: the points of bucket b are
+// point(k) for k in [start(b), start(b + 1)). Two points closer than cell_size always share a bucket or sit in
+// adjacent ones, so a short-range search only looks at the 27 buckets around a point.
+class CellList {
+public:
+    CellList();
+
+    // Bin count points with a counting sort, O(count + buckets)
+    void build(int count, const float* x, const float* y, const float* z, float cell_size);
+
+    int point_count() const { return (int)m_order.size(); }
+    int dimension() const { return m_dimension; }
+    int bucket_count() const { return m_dimension * m_dimension * m_dimension; }
+    float bucket_size() const { return m_size; }
+
+    int bucket(int bx, int by, int bz) const { return bx + m_dimension * (by + m_dimension * bz); }
+    int bucket_of(float x, float y, float z) const;
+
+    int start(int b) const { return m_start[b]; }
+    int point(int k) const { return m_order[k]; }
+    const int* order() const { return m_order.data(); }
+
+private:
+    int coordinate(float v, float origin) const;
+
+    int m_dimension;
+    float m_origin[3];
+    float m_size;
+    std::vector<int> m_start; // bucket_count() + 1 offsets into m_order
+    std::vector<int> m_order; // Point indices grouped by bucket
+};
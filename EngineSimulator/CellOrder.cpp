@@ -0,0 +1,190 @@
+#include "CellOrder.h"
+#include "ThreadPool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CELL_ORDER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics of any instruction set without extra flags; GCC and Clang need them enabled per function
+#if defined(CELL_ORDER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CELL_ORDER_TARGET_BMI2 __attribute__((target("bmi2")))
+#else
+#define CELL_ORDER_TARGET_BMI2
+#endif
+
+namespace {
+    // Bits of the x, y and z coordinates within a code
+    const uint32_t x_mask = 0x09249249u;
+    const uint32_t y_mask = 0x12492492u;
+    const uint32_t z_mask = 0x24924924u;
+
+    // Spread the low 10 bits of v two bits apart, and gather them back
+    inline uint32_t spread(uint32_t v) {
+        v &= 0x3ffu;
+        v = (v | (v << 16)) & 0x030000ffu;
+        v = (v | (v << 8)) & 0x0300f00fu;
+        v = (v | (v << 4)) & 0x030c30c3u;
+        v = (v | (v << 2)) & 0x09249249u;
+        return v;
+    }
+
+    inline uint32_t compact(uint32_t v) {
+        v &= 0x09249249u;
+        v = (v | (v >> 2)) & 0x030c30c3u;
+        v = (v | (v >> 4)) & 0x0300f00fu;
+        v = (v | (v >> 8)) & 0x030000ffu;
+        v = (v | (v >> 16)) & 0x3ffu;
+        return v;
+    }
+
+#ifdef CELL_ORDER_X86
+    CELL_ORDER_TARGET_BMI2 uint32_t encode_bmi2(uint32_t x, uint32_t y, uint32_t z) {
+        return _pdep_u32(x, x_mask) | _pdep_u32(y, y_mask) | _pdep_u32(z, z_mask);
+    }
+
+    CELL_ORDER_TARGET_BMI2 void decode_bmi2(uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z) {
+        x = _pext_u32(code, x_mask);
+        y = _pext_u32(code, y_mask);
+        z = _pext_u32(code, z_mask);
+    }
+
+    bool detect_bmi2() {
+        unsigned int regs[4];
+#ifdef _MSC_VER
+        int info[4];
+        __cpuidex(info, 0, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        regs[1] = (unsigned int)info[1];
+#else
+        __cpuid_count(0, 0, regs[0], regs[1], regs[2], regs[3]);
+        if (regs[0] < 7) {
+            return false;
+        }
+        __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+        return (regs[1] & (1u << 8)) != 0;
+    }
+#endif
+
+    bool has_bmi2() {
+#ifdef CELL_ORDER_X86
+        static bool available = detect_bmi2();
+        return available;
+#else
+        return false;
+#endif
+    }
+}
+
+uint32_t morton_encode(uint32_t x, uint32_t y, uint32_t z) {
+#ifdef CELL_ORDER_X86
+    if (has_bmi2()) {
+        return encode_bmi2(x, y, z);
+    }
+#endif
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+void morton_decode(uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z) {
+#ifdef CELL_ORDER_X86
+    if (has_bmi2()) {
+        decode_bmi2(code, x, y, z);
+        return;
+    }
+#endif
+    x = compact(code);
+    y = compact(code >> 1);
+    z = compact(code >> 2);
+}
+
+bool morton_uses_bmi2() {
+    return has_bmi2();
+}
+
+CellLayout::CellLayout() :
+    m_n(0),
+    m_order(CellOrder::RowMajor)
+{
+}
+
+CellLayout::CellLayout(int n, CellOrder order) :
+    m_n(0),
+    m_order(order)
+{
+    build(n, order);
+}
+
+void CellLayout::build(int n, CellOrder order) {
+    m_n = n;
+    m_order = order;
+    int cells = n * n * n;
+    m_slot.resize(cells);
+    m_cell.resize(cells);
+
+    if (order == CellOrder::RowMajor) {
+        for (int i = 0; i < cells; i++) {
+            m_slot[i] = i;
+            m_cell[i] = i;
+        }
+        return;
+    }
+
+    // Walk the codes of the enclosing power-of-two cube in order, skipping the cells outside the grid; the cube
+    // holds fewer than 8 * n^3 codes
+    uint32_t side = 1;
+    while ((int)side < n) {
+        side <<= 1;
+    }
+    int slot = 0;
+    for (uint32_t code = 0; code < side * side * side; code++) {
+        uint32_t x;
+        uint32_t y;
+        uint32_t z;
+        morton_decode(code, x, y, z);
+        if ((int)x >= n || (int)y >= n || (int)z >= n) {
+            continue;
+        }
+
+        int i = (int)x + n * ((int)y + n * (int)z);
+        m_slot[i] = slot;
+        m_cell[slot] = i;
+        slot++;
+    }
+}
+
+void CellLayout::to_row_major(const float* stored, float* row) const {
+    parallel_for(0, (int)m_cell.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            row[m_cell[k]] = stored[k];
+        }
+    });
+}
+
+void CellLayout::from_row_major(const float* row, float* stored) const {
+    parallel_for(0, (int)m_cell.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            stored[k] = row[m_cell[k]];
+        }
+    });
+}
+
+void CellLayout::to_row_major(const VectorField& stored, VectorField& row) const {
+    for (int c = 0; c < 3; c++) {
+        to_row_major(stored.component(c), row.component(c));
+    }
+}
+
+void CellLayout::from_row_major(const VectorField& row, VectorField& stored) const {
+    for (int c = 0; c < 3; c++) {
+        from_row_major(row.component(c), stored.component(c));
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "FieldStorage.h"
+
+// Order in which the cells of an n*n*n grid are laid out in memory
+enum class CellOrder {
+    RowMajor, // i = x + n * y + n * n * z; z neighbors are n * n cells apart
+    Morton    // Z-order: cells sorted by their interleaved coordinate bits, so every octree box is one contiguous run
+};
+
+// Interleave the bits of x, y and z (each below 1024) into ...z1y1x1z0y0x0, with BMI2 pdep where the CPU has it
+uint32_t morton_encode(uint32_t x, uint32_t y, uint32_t z);
+
+// Split a Morton code back into its coordinates, with BMI2 pext where the CPU has it
+void morton_decode(uint32_t code, uint32_t& x, uint32_t& y, uint32_t& z);
+
+// Code of the neighbor one step up or down along axis 0 (x), 1 (y) or 2 (z), found by carrying through that
+// axis's bits alone; the coordinate must not already be at the edge of the power-of-two cube in that direction
+inline uint32_t morton_increment(uint32_t code, int axis) {
+    uint32_t mask = 0x09249249u << axis;
+    return (((code | ~mask) + 1) & mask) | (code & ~mask);
+}
+
+inline uint32_t morton_decrement(uint32_t code, int axis) {
+    uint32_t mask = 0x09249249u << axis;
+    return (((code & mask) - 1) & mask) | (code & ~mask);
+}
+
+// Whether morton_encode and morton_decode run on BMI2
+bool morton_uses_bmi2();
+
+// Storage slot of every cell of an n*n*n grid in one cell order, and back.
+// Grids whose size is not a power of two keep the Z-order of the enclosing power-of-two cube with its empty
+// cells left out, so the slots are dense and octree boxes stay contiguous; on power-of-two grids the slot of a
+// cell is its Morton code.
+class CellLayout {
+public:
+    CellLayout();
+    CellLayout(int n, CellOrder order);
+
+    void build(int n, CellOrder order);
+
+    int dimension() const { return m_n; }
+    CellOrder order() const { return m_order; }
+
+    // Slot holding the row-major cell, and the row-major cell in a slot
+    int slot(int cell) const { return m_slot[cell]; }
+    int cell(int slot) const { return m_cell[slot]; }
+    const int* cells() const { return m_cell.data(); }
+
+    // Convert a field between this layout and row-major order, e.g. for output; stored and row must not overlap
+    void to_row_major(const float* stored, float* row) const;
+    void from_row_major(const float* row, float* stored) const;
+    void to_row_major(const VectorField& stored, VectorField& row) const;
+    void from_row_major(const VectorField& row, VectorField& stored) const;
+
+private:
+    int m_n;
+    CellOrder m_order;
+    std::vector<int> m_slot; // Slot of every row-major cell
+    std::vector<int> m_cell; // Row-major cell of every slot
+};
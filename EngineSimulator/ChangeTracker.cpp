@@ -0,0 +1,105 @@
+#include "ChangeTracker.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+ChangeTracker::ChangeTracker() :
+    m_tolerance(0.0f),
+    m_tracking(false)
+{
+}
+
+void ChangeTracker::set_tolerance(float tolerance) {
+    m_tolerance = tolerance;
+}
+
+void ChangeTracker::reset(int cells, const float* values) {
+    if ((int)m_applied.size() != cells) {
+        m_applied.resize(cells);
+    }
+    memcpy(m_applied.data(), values, cells * sizeof(float));
+    m_dirty.clear();
+    m_delta.clear();
+    m_tracking = true;
+}
+
+int ChangeTracker::scan(const float* values) {
+    m_dirty.clear();
+    m_delta.clear();
+
+    // Chunks find their changed cells on their own; sorting them by chunk start keeps the cells in index order, so
+    // the changes are applied in the same order on every run
+    std::mutex mutex;
+    std::vector<std::pair<int, std::vector<int> > > found;
+    int cells = (int)m_applied.size();
+    parallel_for(0, cells, [&](int begin, int end) {
+        std::vector<int> local;
+        for (int i = begin; i < end; i++) {
+            if (fabs(values[i] - m_applied[i]) > m_tolerance) {
+                local.push_back(i);
+            }
+        }
+
+        if (!local.empty()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            found.push_back(std::make_pair(begin, local));
+        }
+    });
+
+    std::sort(found.begin(), found.end());
+    for (size_t c = 0; c < found.size(); c++) {
+        m_dirty.insert(m_dirty.end(), found[c].second.begin(), found[c].second.end());
+    }
+    m_delta.resize(m_dirty.size());
+    for (size_t d = 0; d < m_dirty.size(); d++) {
+        m_delta[d] = values[m_dirty[d]] - m_applied[m_dirty[d]];
+    }
+    return (int)m_dirty.size();
+}
+
+void ChangeTracker::commit(const float* values) {
+    for (size_t d = 0; d < m_dirty.size(); d++) {
+        m_applied[m_dirty[d]] = values[m_dirty[d]];
+    }
+}
+
+void add_source_changes(int n, float h, const OffsetKernelTable* table, const OffsetKernelTable::Magnitude& magnitude,
+    int count, const int* cells, const float* delta, float coupling, VectorField& out) {
+    std::vector<int> cx(count);
+    std::vector<int> cy(count);
+    std::vector<int> cz(count);
+    for (int d = 0; d < count; d++) {
+        cx[d] = cells[d] % n;
+        cy[d] = (cells[d] / n) % n;
+        cz[d] = cells[d] / (n * n);
+    }
+
+    // Every target gathers from the few changed sources, so targets run in parallel without sharing writes
+    parallel_for(0, n * n * n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            int x = i % n;
+            int y = (i / n) % n;
+            int z = i / (n * n);
+            float fx = 0.0f;
+            float fy = 0.0f;
+            float fz = 0.0f;
+            for (int d = 0; d < count; d++) {
+                float value[3];
+                if (table) {
+                    table->lookup(x - cx[d], y - cy[d], z - cz[d], value);
+                }
+                else {
+                    OffsetKernelTable::evaluate(x - cx[d], y - cy[d], z - cz[d], h, magnitude, value);
+                }
+                fx += delta[d] * value[0];
+                fy += delta[d] * value[1];
+                fz += delta[d] * value[2];
+            }
+            out.add(i, coupling * fx, coupling * fy, coupling * fz);
+        }
+    });
+}
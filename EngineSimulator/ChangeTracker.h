@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "FieldStorage.h"
+#include "KernelTable.h"
+
+// Cells of a field whose value moved by more than a tolerance since the values were last applied.
+// Changes below the tolerance are not dropped: they stay pending against the applied values and are picked up once
+// they add up past it, so what was applied never lags the field by more than the tolerance.
+class ChangeTracker {
+public:
+    ChangeTracker();
+
+    void set_tolerance(float tolerance);
+    float tolerance() const { return m_tolerance; }
+
+    // Take the values as applied, e.g. after a full recalculation from them
+    void reset(int cells, const float* values);
+    bool tracking() const { return m_tracking; }
+    void stop() { m_tracking = false; }
+
+    // Find the changed cells and their changes since the applied values; returns how many there are
+    int scan(const float* values);
+    int dirty_count() const { return (int)m_dirty.size(); }
+    const int* dirty() const { return m_dirty.data(); }
+    const float* delta() const { return m_delta.data(); }
+
+    // Take the values of the changed cells found by the last scan as applied
+    void commit(const float* values);
+
+private:
+    float m_tolerance;
+    bool m_tracking;
+    ScalarField m_applied;
+    std::vector<int> m_dirty;
+    std::vector<float> m_delta;
+};
+
+// out[i] += coupling * sum over the changed cells j of delta[j] * K(i - j) on an n*n*n grid, with K read from the
+// table or, when there is none, evaluated from magnitude; O(n^3 * count)
+void add_source_changes(int n, float h, const OffsetKernelTable* table, const OffsetKernelTable::Magnitude& magnitude,
+    int count, const int* cells, const float* delta, float coupling, VectorField& out);
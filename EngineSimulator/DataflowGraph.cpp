@@ -0,0 +1,121 @@
+#include "DataflowGraph.h"
+#include "TaskGraph.h"
+
+DataflowGraph::DataflowGraph() :
+    m_computed(0)
+{
+}
+
+DataflowGraph::Node DataflowGraph::add(const std::function<void()>& compute) {
+    Entry entry;
+    entry.compute = compute;
+    entry.dirty = true;
+    m_nodes.push_back(entry);
+    return (Node)m_nodes.size() - 1;
+}
+
+void DataflowGraph::depend(Node node, Node input) {
+    m_nodes[node].inputs.push_back(input);
+    m_nodes[input].outputs.push_back(node);
+    if (m_nodes[input].dirty) {
+        invalidate(node);
+    }
+}
+
+void DataflowGraph::invalidate(Node node) {
+    std::vector<Node> stack(1, node);
+    while (!stack.empty()) {
+        Node n = stack.back();
+        stack.pop_back();
+        m_nodes[n].dirty = true;
+
+        // A dirty node's outputs were marked when it was
+        for (size_t o = 0; o < m_nodes[n].outputs.size(); o++) {
+            if (!m_nodes[m_nodes[n].outputs[o]].dirty) {
+                stack.push_back(m_nodes[n].outputs[o]);
+            }
+        }
+    }
+}
+
+void DataflowGraph::validate(Node node) {
+    for (size_t i = 0; i < m_nodes[node].inputs.size(); i++) {
+        if (m_nodes[m_nodes[node].inputs[i]].dirty) {
+            return;
+        }
+    }
+    m_nodes[node].dirty = false;
+}
+
+int DataflowGraph::update(ThreadPool& pool, Node target) {
+    // Everything target reads, which is all a clean target needs checked
+    std::vector<bool> selected(m_nodes.size(), false);
+    std::vector<Node> stack(1, target);
+    selected[target] = true;
+    while (!stack.empty()) {
+        Node n = stack.back();
+        stack.pop_back();
+        for (size_t i = 0; i < m_nodes[n].inputs.size(); i++) {
+            Node input = m_nodes[n].inputs[i];
+            if (!selected[input]) {
+                selected[input] = true;
+                stack.push_back(input);
+            }
+        }
+    }
+    return run(pool, selected);
+}
+
+int DataflowGraph::update(ThreadPool& pool) {
+    return run(pool, std::vector<bool>(m_nodes.size(), true));
+}
+
+int DataflowGraph::run(ThreadPool& pool, const std::vector<bool>& selected) {
+    int count = size();
+    std::vector<TaskGraph::Node> task(count, -1);
+    TaskGraph graph;
+    for (Node n = 0; n < count; n++) {
+        if (selected[n] && m_nodes[n].dirty) {
+            const std::function<void()>& compute = m_nodes[n].compute;
+            task[n] = graph.add([&compute] {
+                if (compute) {
+                    compute();
+                }
+            });
+        }
+    }
+
+    // A dirty node waits for the nearest dirty nodes upstream, looking through clean ones in between
+    for (Node n = 0; n < count; n++) {
+        if (task[n] < 0) {
+            continue;
+        }
+
+        std::vector<bool> seen(count, false);
+        std::vector<Node> stack(m_nodes[n].inputs);
+        while (!stack.empty()) {
+            Node input = stack.back();
+            stack.pop_back();
+            if (seen[input]) {
+                continue;
+            }
+            seen[input] = true;
+
+            if (task[input] >= 0) {
+                graph.depend(task[n], task[input]);
+            }
+            else {
+                stack.insert(stack.end(), m_nodes[input].inputs.begin(), m_nodes[input].inputs.end());
+            }
+        }
+    }
+
+    graph.run(pool);
+    for (Node n = 0; n < count; n++) {
+        if (task[n] >= 0) {
+            m_nodes[n].dirty = false;
+        }
+    }
+    m_computed += graph.size();
+    return graph.size();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Derived values kept up to date on demand. Every node has a function that recomputes it from the nodes it reads
+// and a dirty flag; invalidating a node marks everything downstream of it dirty, and update recomputes only the
+// dirty nodes, each after the dirty nodes it reads, with independent ones running concurrently as a TaskGraph.
+class DataflowGraph {
+public:
+    typedef int Node;
+
+    DataflowGraph();
+
+    // New nodes start dirty; compute may be empty for a node that only gathers others
+    Node add(const std::function<void()>& compute);
+
+    // node reads input, so it is dirty whenever input is
+    void depend(Node node, Node input);
+
+    // Mark node and everything downstream of it dirty
+    void invalidate(Node node);
+
+    // Mark node up to date after it was computed by other means; a node with a dirty input stays dirty
+    void validate(Node node);
+
+    bool dirty(Node node) const { return m_nodes[node].dirty; }
+
+    // Recompute the dirty nodes target reads, directly or not, and target itself; returns how many were computed
+    int update(ThreadPool& pool, Node target);
+
+    // Recompute every dirty node
+    int update(ThreadPool& pool);
+
+    // Nodes computed by update so far
+    long long computed() const { return m_computed; }
+
+    int size() const { return (int)m_nodes.size(); }
+
+private:
+    struct Entry {
+        std::function<void()> compute;
+        std::vector<Node> inputs;
+        std::vector<Node> outputs;
+        bool dirty;
+    };
+
+    int run(ThreadPool& pool, const std::vector<bool>& selected);
+
+    std::vector<Entry> m_nodes;
+    long long m_computed;
+};
@@ -0,0 +1,64 @@
+#include "DirectSum.h"
+#include "ForceKernels.h"
+
+void direct_gravity(int n, float h, const float* rho, VectorField& Fg) {
+    int cells = n * n * n;
+
+    // Calculate the forces on each cell in the dataset due to gravity
+    for (int i = 0; i < cells; i++) {
+        float fx = 0.0f;
+        float fy = 0.0f;
+        float fz = 0.0f;
+
+        for (int j = 0; j < cells; j++) {
+            if (i == j) {
+                continue;
+            }
+
+            float dx = (i % n - j % n) * h;
+            float dy = ((i / n) % n - (j / n) % n) * h;
+            float dz = (i / (n * n) - j / (n * n)) * h;
+
+            float r = sqrt(dx * dx + dy * dy + dz * dz);
+
+            // Calculate the force on each cell in the dataset due to gravity
+            float Fg_ij = gravity_kernel(r) * rho[j];
+
+            fx += Fg_ij * dx / r;
+            fy += Fg_ij * dy / r;
+            fz += Fg_ij * dz / r;
+        }
+
+        Fg.set(i, fx, fy, fz);
+    }
+}
+
+void direct_inverse_square(int n, float h, const float* q, float coupling, VectorField& F) {
+    int cells = n * n * n;
+
+    for (int i = 0; i < cells; i++) {
+        float fx = 0.0f;
+        float fy = 0.0f;
+        float fz = 0.0f;
+
+        for (int j = 0; j < cells; j++) {
+            if (i == j) {
+                continue;
+            }
+
+            float dx = (i % n - j % n) * h;
+            float dy = ((i / n) % n - (j / n) % n) * h;
+            float dz = (i / (n * n) - j / (n * n)) * h;
+
+            float r = sqrt(dx * dx + dy * dy + dz * dz);
+
+            float F_ij = coupling * q[i] * q[j] / r / r;
+
+            fx += F_ij * dx / r;
+            fy += F_ij * dy / r;
+            fz += F_ij * dz / r;
+        }
+
+        F.set(i, fx, fy, fz);
+    }
+}
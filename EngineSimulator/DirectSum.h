@@ -0,0 +1,9 @@
+#pragma once
+
+#include "FieldStorage.h"
+
+// Brute-force all-pairs gravity on an n*n*n grid of spacing h, used as the reference solver
+void direct_gravity(int n, float h, const float* rho, VectorField& Fg);
+
+// Brute-force all-pairs inverse-square force F[i] = coupling * q[i] * sum of q[j] * (x[i] - x[j]) / r^3
+void direct_inverse_square(int n, float h, const float* q, float coupling, VectorField& F);
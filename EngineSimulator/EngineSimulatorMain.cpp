@@ -1,6 +1,12 @@
 #include "pch.h"
 #include "EngineSimulatorMain.h"
 
+#ifdef ENGINE_FORCE_CHECKS
+#include <sstream>
+
+#include "Benchmarks.h"
+#endif
+
 using namespace EngineSimulator;
 
 EngineSimulatorMain::EngineSimulatorMain() :
@@ -12,6 +18,17 @@ EngineSimulatorMain::EngineSimulatorMain() :
 
 void EngineSimulatorMain::Initialize(HWND window, int width, int height)
 {
+#ifdef ENGINE_FORCE_CHECKS
+    // Check the optimized force paths against their references before the simulation starts
+    std::ostringstream report;
+    int failures = run_force_checks(report);
+    OutputDebugStringA(report.str().c_str());
+    if (failures > 0)
+    {
+        __debugbreak();
+    }
+#endif
+
     m_engineSimulator.Initialize();
 }
 
@@ -24,7 +24,6 @@ namespace EngineSimulator
         DX::StepTimer m_timer;
         bool m_windowClosed;
         bool m_windowVisible;
-        CMBDataset m_cmbDataset;
         UniverseSimulator m_engineSimulator;
     };
 }
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "FFT.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double two_pi = 6.283185307179586;
+}
+
+bool is_power_of_two(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+int next_power_of_two(int n) {
+    int m = 1;
+    while (m < n) {
+        m <<= 1;
+    }
+    return m;
+}
+
+template <typename Real>
+Fft1D<Real>::Fft1D(int n) :
+    m_n(n),
+    m_m(is_power_of_two(n) ? n : next_power_of_two(2 * n - 1))
+{
+    // Radix-2 tables for the transform length
+    int bits = 0;
+    while ((1 << bits) < m_m) {
+        bits++;
+    }
+
+    m_bitrev.resize(m_m);
+    for (int k = 0; k < m_m; k++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        m_bitrev[k] = r;
+    }
+
+    m_twiddles.resize(m_m / 2);
+    for (int k = 0; k < m_m / 2; k++) {
+        double angle = -two_pi * k / m_m;
+        m_twiddles[k] = Complex((Real)cos(angle), (Real)sin(angle));
+    }
+
+    if (m_m == m_n) {
+        return;
+    }
+
+    // Bluestein chirp and the transform of its conjugate, padded to the radix-2 length
+    m_chirp.resize(m_n);
+    for (int k = 0; k < m_n; k++) {
+        // k^2 is reduced modulo 2n to keep the angle accurate for long transforms
+        long long k2 = ((long long)k * k) % (2LL * m_n);
+        double angle = -0.5 * two_pi * (double)k2 / m_n;
+        m_chirp[k] = Complex((Real)cos(angle), (Real)sin(angle));
+    }
+
+    m_chirp_k.assign(m_m, Complex(0, 0));
+    m_chirp_k[0] = std::conj(m_chirp[0]);
+    for (int k = 1; k < m_n; k++) {
+        m_chirp_k[k] = std::conj(m_chirp[k]);
+        m_chirp_k[m_m - k] = std::conj(m_chirp[k]);
+    }
+    radix2(m_chirp_k.data(), false);
+}
+
+template <typename Real>
+void Fft1D<Real>::transform(Complex* data, bool inverse, Complex* scratch) const {
+    if (m_n == 1) {
+        return;
+    }
+
+    if (m_m == m_n) {
+        radix2(data, inverse);
+    }
+    else {
+        bluestein(data, inverse, scratch);
+    }
+}
+
+template <typename Real>
+void Fft1D<Real>::radix2(Complex* data, bool inverse) const {
+    for (int k = 0; k < m_m; k++) {
+        if (k < m_bitrev[k]) {
+            std::swap(data[k], data[m_bitrev[k]]);
+        }
+    }
+
+    for (int len = 2; len <= m_m; len <<= 1) {
+        int half = len / 2;
+        int step = m_m / len;
+        for (int start = 0; start < m_m; start += len) {
+            for (int k = 0; k < half; k++) {
+                Complex w = inverse ? std::conj(m_twiddles[k * step]) : m_twiddles[k * step];
+                Complex u = data[start + k];
+                Complex v = data[start + k + half] * w;
+                data[start + k] = u + v;
+                data[start + k + half] = u - v;
+            }
+        }
+    }
+}
+
+template <typename Real>
+void Fft1D<Real>::bluestein(Complex* data, bool inverse, Complex* scratch) const {
+    // The inverse transform is the conjugate of the forward transform of the conjugated input
+    for (int k = 0; k < m_n; k++) {
+        Complex x = inverse ? std::conj(data[k]) : data[k];
+        scratch[k] = x * m_chirp[k];
+    }
+    for (int k = m_n; k < m_m; k++) {
+        scratch[k] = Complex(0, 0);
+    }
+
+    radix2(scratch, false);
+    for (int k = 0; k < m_m; k++) {
+        scratch[k] *= m_chirp_k[k];
+    }
+    radix2(scratch, true);
+
+    Real scale = (Real)1 / m_m;
+    for (int k = 0; k < m_n; k++) {
+        Complex X = scratch[k] * m_chirp[k] * scale;
+        data[k] = inverse ? std::conj(X) : X;
+    }
+}
+
+template <typename Real>
+Fft3D<Real>::Fft3D(int nx, int ny, int nz) :
+    m_nx(nx),
+    m_ny(ny),
+    m_nz(nz),
+    m_fft_x(nx % 2 == 0 ? nx / 2 : nx),
+    m_fft_y(ny),
+    m_fft_z(nz)
+{
+    if (nx % 2 == 0) {
+        m_half_twiddles.resize(nx / 2 + 1);
+        for (int k = 0; k <= nx / 2; k++) {
+            double angle = -two_pi * k / nx;
+            m_half_twiddles[k] = Complex((Real)cos(angle), (Real)sin(angle));
+        }
+    }
+}
+
+template <typename Real>
+void Fft3D<Real>::make_workspace(Workspace& workspace) const {
+    int longest = std::max(m_nx, std::max(m_ny, m_nz));
+    int scratch = std::max(m_fft_x.scratch_size(), std::max(m_fft_y.scratch_size(), m_fft_z.scratch_size()));
+    workspace.line.resize(longest);
+    workspace.scratch.resize(scratch);
+}
+
+template <typename Real>
+void Fft3D<Real>::forward(const Real* in, Complex* out) const {
+    int cnx = complex_nx();
+
+    // Transform every x line, keeping only the non-redundant half of the spectrum
+    parallel_for(0, m_ny * m_nz, [&](int begin, int end) {
+        Workspace workspace;
+        make_workspace(workspace);
+        Complex* line_data = workspace.line.data();
+
+        for (int line = begin; line < end; line++) {
+            const Real* x = in + line * m_nx;
+            Complex* X = out + line * cnx;
+
+            if (m_nx % 2 == 0) {
+                // Pack even and odd samples into one complex sequence of half the length
+                int half = m_nx / 2;
+                for (int k = 0; k < half; k++) {
+                    line_data[k] = Complex(x[2 * k], x[2 * k + 1]);
+                }
+                m_fft_x.transform(line_data, false, workspace.scratch.data());
+
+                for (int k = 0; k <= half; k++) {
+                    Complex Zk = line_data[k % half];
+                    Complex Zc = std::conj(line_data[(half - k) % half]);
+                    Complex even = (Real)0.5 * (Zk + Zc);
+                    Complex odd = Complex(0, (Real)-0.5) * (Zk - Zc);
+                    X[k] = even + m_half_twiddles[k] * odd;
+                }
+            }
+            else {
+                for (int k = 0; k < m_nx; k++) {
+                    line_data[k] = Complex(x[k], 0);
+                }
+                m_fft_x.transform(line_data, false, workspace.scratch.data());
+
+                for (int k = 0; k < cnx; k++) {
+                    X[k] = line_data[k];
+                }
+            }
+        }
+    });
+
+    transform_yz(out, false);
+}
+
+template <typename Real>
+void Fft3D<Real>::inverse(Complex* in, Real* out) const {
+    int cnx = complex_nx();
+
+    transform_yz(in, true);
+
+    Real scale;
+    if (m_nx % 2 == 0) {
+        scale = (Real)1 / ((Real)(m_nx / 2) * m_ny * m_nz);
+    }
+    else {
+        scale = (Real)1 / ((Real)m_nx * m_ny * m_nz);
+    }
+
+    parallel_for(0, m_ny * m_nz, [&](int begin, int end) {
+        Workspace workspace;
+        make_workspace(workspace);
+        Complex* line_data = workspace.line.data();
+
+        for (int line = begin; line < end; line++) {
+            const Complex* X = in + line * cnx;
+            Real* x = out + line * m_nx;
+
+            if (m_nx % 2 == 0) {
+                // Rebuild the packed half-length sequence from the half spectrum
+                int half = m_nx / 2;
+                for (int k = 0; k < half; k++) {
+                    Complex Xc = std::conj(X[half - k]);
+                    Complex even = (Real)0.5 * (X[k] + Xc);
+                    Complex odd = (Real)0.5 * (X[k] - Xc) * std::conj(m_half_twiddles[k]);
+                    line_data[k] = even + Complex(0, 1) * odd;
+                }
+                m_fft_x.transform(line_data, true, workspace.scratch.data());
+
+                for (int k = 0; k < half; k++) {
+                    x[2 * k] = line_data[k].real() * scale;
+                    x[2 * k + 1] = line_data[k].imag() * scale;
+                }
+            }
+            else {
+                // Restore the redundant half from Hermitian symmetry
+                for (int k = 0; k < cnx; k++) {
+                    line_data[k] = X[k];
+                }
+                for (int k = cnx; k < m_nx; k++) {
+                    line_data[k] = std::conj(X[m_nx - k]);
+                }
+                m_fft_x.transform(line_data, true, workspace.scratch.data());
+
+                for (int k = 0; k < m_nx; k++) {
+                    x[k] = line_data[k].real() * scale;
+                }
+            }
+        }
+    });
+}
+
+template <typename Real>
+void Fft3D<Real>::transform_yz(Complex* data, bool inverse) const {
+    int cnx = complex_nx();
+
+    // Transform along y, one xy plane per task
+    parallel_for(0, m_nz, [&](int begin, int end) {
+        Workspace workspace;
+        make_workspace(workspace);
+
+        for (int z = begin; z < end; z++) {
+            for (int kx = 0; kx < cnx; kx++) {
+                Complex* base = data + z * m_ny * cnx + kx;
+                for (int y = 0; y < m_ny; y++) {
+                    workspace.line[y] = base[y * cnx];
+                }
+                m_fft_y.transform(workspace.line.data(), inverse, workspace.scratch.data());
+                for (int y = 0; y < m_ny; y++) {
+                    base[y * cnx] = workspace.line[y];
+                }
+            }
+        }
+    });
+
+    // Transform along z, one xz plane per task
+    parallel_for(0, m_ny, [&](int begin, int end) {
+        Workspace workspace;
+        make_workspace(workspace);
+
+        for (int y = begin; y < end; y++) {
+            for (int kx = 0; kx < cnx; kx++) {
+                Complex* base = data + y * cnx + kx;
+                for (int z = 0; z < m_nz; z++) {
+                    workspace.line[z] = base[z * m_ny * cnx];
+                }
+                m_fft_z.transform(workspace.line.data(), inverse, workspace.scratch.data());
+                for (int z = 0; z < m_nz; z++) {
+                    base[z * m_ny * cnx] = workspace.line[z];
+                }
+            }
+        }
+    });
+}
+
+template class Fft1D<float>;
+template class Fft1D<double>;
+template class Fft3D<float>;
+template class Fft3D<double>;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+bool is_power_of_two(int n);
+int next_power_of_two(int n);
+
+// One-dimensional complex FFT of any length.
+// Powers of two use an iterative radix-2 transform, other lengths go through Bluestein's algorithm.
+template <typename Real>
+class Fft1D {
+public:
+    typedef std::complex<Real> Complex;
+
+    explicit Fft1D(int n = 1);
+
+    int size() const { return m_n; }
+
+    // Length of the scratch buffer transform needs, zero for powers of two
+    int scratch_size() const { return m_m == m_n ? 0 : m_m; }
+
+    // Transform data in place; the inverse is not normalized. The object is only read, so several threads
+    // may transform at once as long as each passes its own scratch of scratch_size() elements.
+    void transform(Complex* data, bool inverse, Complex* scratch) const;
+
+private:
+    void radix2(Complex* data, bool inverse) const;
+    void bluestein(Complex* data, bool inverse, Complex* scratch) const;
+
+    int m_n;
+    int m_m; // Radix-2 length used for the transform itself
+    std::vector<int> m_bitrev;
+    std::vector<Complex> m_twiddles;
+    std::vector<Complex> m_chirp;   // exp(-i*pi*k^2/n) for Bluestein
+    std::vector<Complex> m_chirp_k; // Forward transform of the conjugated chirp filter
+};
+
+// Three-dimensional real-to-complex FFT over an nx*ny*nz array stored with x fastest.
+// The complex side keeps the nx/2+1 non-redundant x frequencies, also stored with x fastest.
+// The line transforms along each axis are spread over the thread pool.
+template <typename Real>
+class Fft3D {
+public:
+    typedef std::complex<Real> Complex;
+
+    Fft3D(int nx, int ny, int nz);
+
+    int nx() const { return m_nx; }
+    int ny() const { return m_ny; }
+    int nz() const { return m_nz; }
+    int complex_nx() const { return m_nx / 2 + 1; }
+    int real_size() const { return m_nx * m_ny * m_nz; }
+    int complex_size() const { return complex_nx() * m_ny * m_nz; }
+
+    // Real-to-complex forward transform
+    void forward(const Real* in, Complex* out) const;
+
+    // Complex-to-real inverse transform, normalized by 1/(nx*ny*nz); overwrites in
+    void inverse(Complex* in, Real* out) const;
+
+private:
+    // Line and Bluestein scratch for one thread, sized for the longest axis
+    struct Workspace {
+        std::vector<Complex> line;
+        std::vector<Complex> scratch;
+    };
+
+    void transform_yz(Complex* data, bool inverse) const;
+    void make_workspace(Workspace& workspace) const;
+
+    int m_nx;
+    int m_ny;
+    int m_nz;
+    Fft1D<Real> m_fft_x;      // Half length when nx is even, full length otherwise
+    Fft1D<Real> m_fft_y;
+    Fft1D<Real> m_fft_z;
+    std::vector<Complex> m_half_twiddles; // exp(-2*pi*i*k/nx) to split the packed real transform
+};
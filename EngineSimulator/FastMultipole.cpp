@@ -0,0 +1,464 @@
+#include "FastMultipole.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+    const double pi_d = 3.141592653589793;
+
+    // Offsets between well-separated boxes stay within [-3, 3] in each dimension
+    const int offset_range = 7;
+    const int offset_count = offset_range * offset_range * offset_range;
+
+    int offset_index(int ox, int oy, int oz) {
+        return (ox + 3) + offset_range * ((oy + 3) + offset_range * (oz + 3));
+    }
+
+    // Chebyshev interpolation weight S_p(x, node) and its derivative with respect to x
+    void interpolation_weight(int p, double x, double node, double* s, double* ds) {
+        double t_prev = 1.0;  // T_0
+        double t = x;         // T_1
+        double u_prev = 1.0;  // U_0
+        double u = 2.0 * x;   // U_1
+        double n_prev = 1.0;
+        double n_t = node;
+
+        double sum = 0.0;
+        double dsum = 0.0;
+        for (int k = 1; k < p; k++) {
+            // T_k'(x) = k * U_{k-1}(x)
+            sum += n_t * t;
+            dsum += n_t * k * u_prev;
+
+            double t_next = 2.0 * x * t - t_prev;
+            double u_next = 2.0 * x * u - u_prev;
+            double n_next = 2.0 * node * n_t - n_prev;
+            t_prev = t;
+            t = t_next;
+            u_prev = u;
+            u = u_next;
+            n_prev = n_t;
+            n_t = n_next;
+        }
+
+        *s = 1.0 / p + 2.0 / p * sum;
+        if (ds) {
+            *ds = 2.0 / p * dsum;
+        }
+    }
+}
+
+FastMultipoleSolver::FastMultipoleSolver(int order, int leaf_size) :
+    m_order(order),
+    m_leaf_size(leaf_size),
+    m_n(0),
+    m_h(0.0f),
+    m_levels(0)
+{
+}
+
+void FastMultipoleSolver::set_order(int order) {
+    if (order != m_order) {
+        m_order = order;
+        m_n = 0;
+    }
+}
+
+int FastMultipoleSolver::order() const {
+    return m_order;
+}
+
+void FastMultipoleSolver::set_kernel(const RadialFunction& potential, const RadialFunction& force) {
+    m_potential = potential;
+    m_force = force;
+    m_n = 0;
+}
+
+size_t FastMultipoleSolver::table_bytes() const {
+    size_t bytes = 0;
+    for (size_t level = 0; level < m_m2l.size(); level++) {
+        bytes += m_m2l[level].size() * sizeof(float);
+    }
+    return bytes;
+}
+
+bool FastMultipoleSolver::box_in_grid(int level, int bx, int by, int bz) const {
+    int side = m_leaf_size << (m_levels - level);
+    return bx * side < m_n && by * side < m_n && bz * side < m_n;
+}
+
+void FastMultipoleSolver::compute(int n, float h, const float* source, const float* target, float coupling, VectorField& F) {
+    // Operators only depend on the grid, the order and the kernel
+    if (n != m_n || h != m_h) {
+        plan(n, h);
+    }
+
+    upward_pass(source);
+    downward_pass();
+    evaluate(source, target, coupling, F);
+}
+
+void FastMultipoleSolver::plan(int n, float h) {
+    m_n = n;
+    m_h = h;
+
+    int p = m_order;
+    int s = m_leaf_size;
+    int p3 = p * p * p;
+
+    m_levels = 0;
+    while ((s << m_levels) < n) {
+        m_levels++;
+    }
+
+    m_nodes.resize(p);
+    for (int m = 0; m < p; m++) {
+        m_nodes[m] = cos((2.0 * m + 1.0) * pi_d / (2.0 * p));
+    }
+
+    // Cells of a leaf sit at fixed positions in its [-1, 1] coordinates
+    m_leaf_s.resize(s * p);
+    m_leaf_ds.resize(s * p);
+    for (int u = 0; u < s; u++) {
+        double x = (u - 0.5 * (s - 1)) / (0.5 * s);
+        for (int m = 0; m < p; m++) {
+            interpolation_weight(p, x, m_nodes[m], &m_leaf_s[u * p + m], &m_leaf_ds[u * p + m]);
+        }
+    }
+
+    // Nodes of the lower and upper child expressed in the parent's coordinates
+    m_child_s.resize(2 * p * p);
+    for (int c = 0; c < 2; c++) {
+        for (int m = 0; m < p; m++) {
+            double x = (c ? 0.5 : -0.5) + 0.5 * m_nodes[m];
+            for (int M = 0; M < p; M++) {
+                interpolation_weight(p, x, m_nodes[M], &m_child_s[(c * p + m) * p + M], 0);
+            }
+        }
+    }
+
+    // Multipole-to-local operators between the nodes of well-separated boxes at each level
+    m_m2l.assign(m_levels + 1, std::vector<float>());
+    for (int level = 2; level <= m_levels; level++) {
+        double half_width = 0.5 * (s << (m_levels - level)) * h;
+        std::vector<float>& table = m_m2l[level];
+        table.assign((size_t)offset_count * p3 * p3, 0.0f);
+
+        for (int oz = -3; oz <= 3; oz++) {
+            for (int oy = -3; oy <= 3; oy++) {
+                for (int ox = -3; ox <= 3; ox++) {
+                    if (std::abs(ox) <= 1 && std::abs(oy) <= 1 && std::abs(oz) <= 1) {
+                        continue;
+                    }
+
+                    float* op = &table[(size_t)offset_index(ox, oy, oz) * p3 * p3];
+                    for (int t = 0; t < p3; t++) {
+                        for (int u = 0; u < p3; u++) {
+                            // Target node minus source node, with the target box at offset o from the source box
+                            double dx = half_width * (2.0 * ox + m_nodes[t % p] - m_nodes[u % p]);
+                            double dy = half_width * (2.0 * oy + m_nodes[(t / p) % p] - m_nodes[(u / p) % p]);
+                            double dz = half_width * (2.0 * oz + m_nodes[t / (p * p)] - m_nodes[u / (p * p)]);
+                            op[t * p3 + u] = (float)m_potential(sqrt(dx * dx + dy * dy + dz * dz));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    m_multipole.assign(m_levels + 1, std::vector<double>());
+    m_local.assign(m_levels + 1, std::vector<double>());
+    for (int level = 0; level <= m_levels; level++) {
+        size_t boxes = (size_t)boxes_per_side(level) * boxes_per_side(level) * boxes_per_side(level);
+        m_multipole[level].assign(boxes * p3, 0.0);
+        m_local[level].assign(boxes * p3, 0.0);
+    }
+}
+
+void FastMultipoleSolver::upward_pass(const float* source) {
+    int p = m_order;
+    int s = m_leaf_size;
+    int p3 = p * p * p;
+    int nb = boxes_per_side(m_levels);
+
+    // Anterpolate the sources of every leaf onto its Chebyshev nodes
+    std::vector<double>& leaves = m_multipole[m_levels];
+    std::fill(leaves.begin(), leaves.end(), 0.0);
+    parallel_for(0, nb * nb, [&](int begin, int end) {
+        for (int row = begin; row < end; row++) {
+            int bz = row / nb;
+            int by = row % nb;
+
+            for (int bx = 0; bx < nb; bx++) {
+                if (!box_in_grid(m_levels, bx, by, bz)) {
+                    continue;
+                }
+
+                double* W = &leaves[(size_t)(bx + nb * (by + nb * bz)) * p3];
+                for (int w = 0; w < s && bz * s + w < m_n; w++) {
+                    for (int v = 0; v < s && by * s + v < m_n; v++) {
+                        for (int u = 0; u < s && bx * s + u < m_n; u++) {
+                            int j = (bx * s + u) + m_n * ((by * s + v) + m_n * (bz * s + w));
+                            double q = source[j];
+                            if (q == 0.0) {
+                                continue;
+                            }
+
+                            for (int mz = 0; mz < p; mz++) {
+                                double sz = q * m_leaf_s[w * p + mz];
+                                for (int my = 0; my < p; my++) {
+                                    double syz = sz * m_leaf_s[v * p + my];
+                                    for (int mx = 0; mx < p; mx++) {
+                                        W[mx + p * (my + p * mz)] += syz * m_leaf_s[u * p + mx];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // Merge children into their parents
+    for (int level = m_levels - 1; level >= 0; level--) {
+        int parent_side = boxes_per_side(level);
+        std::vector<double>& parents = m_multipole[level];
+        const std::vector<double>& children = m_multipole[level + 1];
+        std::fill(parents.begin(), parents.end(), 0.0);
+
+        parallel_for(0, parent_side * parent_side, [&](int begin, int end) {
+            for (int row = begin; row < end; row++) {
+                int bz = row / parent_side;
+                int by = row % parent_side;
+
+                for (int bx = 0; bx < parent_side; bx++) {
+                    if (!box_in_grid(level, bx, by, bz)) {
+                        continue;
+                    }
+
+                    double* W = &parents[(size_t)(bx + parent_side * (by + parent_side * bz)) * p3];
+                    for (int c = 0; c < 8; c++) {
+                        int cx = c & 1;
+                        int cy = (c >> 1) & 1;
+                        int cz = (c >> 2) & 1;
+                        int child_side = 2 * parent_side;
+                        const double* Wc = &children[(size_t)((2 * bx + cx) + child_side * ((2 * by + cy) + child_side * (2 * bz + cz))) * p3];
+
+                        for (int m = 0; m < p3; m++) {
+                            if (Wc[m] == 0.0) {
+                                continue;
+                            }
+
+                            const double* sx = &m_child_s[(cx * p + m % p) * p];
+                            const double* sy = &m_child_s[(cy * p + (m / p) % p) * p];
+                            const double* sz = &m_child_s[(cz * p + m / (p * p)) * p];
+                            for (int Mz = 0; Mz < p; Mz++) {
+                                for (int My = 0; My < p; My++) {
+                                    double wyz = Wc[m] * sz[Mz] * sy[My];
+                                    for (int Mx = 0; Mx < p; Mx++) {
+                                        W[Mx + p * (My + p * Mz)] += wyz * sx[Mx];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+}
+
+void FastMultipoleSolver::downward_pass() {
+    int p = m_order;
+    int p3 = p * p * p;
+
+    for (int level = 0; level <= m_levels; level++) {
+        std::fill(m_local[level].begin(), m_local[level].end(), 0.0);
+    }
+
+    for (int level = 2; level <= m_levels; level++) {
+        int nb = boxes_per_side(level);
+        const std::vector<float>& table = m_m2l[level];
+        const std::vector<double>& multipole = m_multipole[level];
+        std::vector<double>& local = m_local[level];
+
+        parallel_for(0, nb * nb, [&](int begin, int end) {
+            for (int row = begin; row < end; row++) {
+                int bz = row / nb;
+                int by = row % nb;
+
+                for (int bx = 0; bx < nb; bx++) {
+                    if (!box_in_grid(level, bx, by, bz)) {
+                        continue;
+                    }
+
+                    double* L = &local[(size_t)(bx + nb * (by + nb * bz)) * p3];
+
+                    // Interaction list: children of the parent's neighbors that are not neighbors themselves
+                    int z0 = std::max(0, (bz / 2 - 1) * 2), z1 = std::min(nb - 1, (bz / 2 + 1) * 2 + 1);
+                    int y0 = std::max(0, (by / 2 - 1) * 2), y1 = std::min(nb - 1, (by / 2 + 1) * 2 + 1);
+                    int x0 = std::max(0, (bx / 2 - 1) * 2), x1 = std::min(nb - 1, (bx / 2 + 1) * 2 + 1);
+                    for (int sz = z0; sz <= z1; sz++) {
+                        for (int sy = y0; sy <= y1; sy++) {
+                            for (int sx = x0; sx <= x1; sx++) {
+                                int ox = bx - sx;
+                                int oy = by - sy;
+                                int oz = bz - sz;
+                                if (std::abs(ox) <= 1 && std::abs(oy) <= 1 && std::abs(oz) <= 1) {
+                                    continue;
+                                }
+                                if (!box_in_grid(level, sx, sy, sz)) {
+                                    continue;
+                                }
+
+                                const double* W = &multipole[(size_t)(sx + nb * (sy + nb * sz)) * p3];
+                                const float* op = &table[(size_t)offset_index(ox, oy, oz) * p3 * p3];
+                                for (int t = 0; t < p3; t++) {
+                                    const float* row = op + t * p3;
+                                    double sum = 0.0;
+                                    for (int u = 0; u < p3; u++) {
+                                        sum += row[u] * W[u];
+                                    }
+                                    L[t] += sum;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+
+        if (level == m_levels) {
+            break;
+        }
+
+        // Interpolate every local expansion onto the nodes of its children
+        int child_side = 2 * nb;
+        std::vector<double>& children = m_local[level + 1];
+        parallel_for(0, nb * nb, [&](int begin, int end) {
+            for (int row = begin; row < end; row++) {
+                int bz = row / nb;
+                int by = row % nb;
+
+                for (int bx = 0; bx < nb; bx++) {
+                    if (!box_in_grid(level, bx, by, bz)) {
+                        continue;
+                    }
+
+                    const double* L = &local[(size_t)(bx + nb * (by + nb * bz)) * p3];
+                    for (int c = 0; c < 8; c++) {
+                        int cx = c & 1;
+                        int cy = (c >> 1) & 1;
+                        int cz = (c >> 2) & 1;
+                        double* Lc = &children[(size_t)((2 * bx + cx) + child_side * ((2 * by + cy) + child_side * (2 * bz + cz))) * p3];
+
+                        for (int m = 0; m < p3; m++) {
+                            const double* sx = &m_child_s[(cx * p + m % p) * p];
+                            const double* sy = &m_child_s[(cy * p + (m / p) % p) * p];
+                            const double* sz = &m_child_s[(cz * p + m / (p * p)) * p];
+                            double sum = 0.0;
+                            for (int Mz = 0; Mz < p; Mz++) {
+                                for (int My = 0; My < p; My++) {
+                                    double syz = sz[Mz] * sy[My];
+                                    for (int Mx = 0; Mx < p; Mx++) {
+                                        sum += L[Mx + p * (My + p * Mz)] * syz * sx[Mx];
+                                    }
+                                }
+                            }
+                            Lc[m] += sum;
+                        }
+                    }
+                }
+            }
+        });
+    }
+}
+
+void FastMultipoleSolver::evaluate(const float* source, const float* target, float coupling, VectorField& F) {
+    int p = m_order;
+    int s = m_leaf_size;
+    int p3 = p * p * p;
+    int nb = boxes_per_side(m_levels);
+    double half_width = 0.5 * s * m_h;
+    const std::vector<double>& local = m_local[m_levels];
+
+    // Direct interactions with the neighboring leaves use a table over every offset they can reach
+    int reach = 2 * s - 1;
+    int span = 2 * reach + 1;
+    std::vector<double> near(span * span * span, 0.0);
+    for (int dz = -reach; dz <= reach; dz++) {
+        for (int dy = -reach; dy <= reach; dy++) {
+            for (int dx = -reach; dx <= reach; dx++) {
+                double r = sqrt((double)(dx * dx + dy * dy + dz * dz)) * m_h;
+                near[(dx + reach) + span * ((dy + reach) + span * (dz + reach))] = r > 0.0 ? m_force(r) / r * m_h : 0.0;
+            }
+        }
+    }
+
+    parallel_for(0, nb * nb, [&](int begin, int end) {
+        for (int row = begin; row < end; row++) {
+            int bz = row / nb;
+            int by = row % nb;
+
+            for (int bx = 0; bx < nb; bx++) {
+                if (!box_in_grid(m_levels, bx, by, bz)) {
+                    continue;
+                }
+
+                const double* L = &local[(size_t)(bx + nb * (by + nb * bz)) * p3];
+
+                for (int w = 0; w < s && bz * s + w < m_n; w++) {
+                    for (int v = 0; v < s && by * s + v < m_n; v++) {
+                        for (int u = 0; u < s && bx * s + u < m_n; u++) {
+                            int x = bx * s + u;
+                            int y = by * s + v;
+                            int z = bz * s + w;
+                            int i = x + m_n * (y + m_n * z);
+
+                            // Far field: the force is minus the gradient of the interpolated potential
+                            double gx = 0.0;
+                            double gy = 0.0;
+                            double gz = 0.0;
+                            for (int mz = 0; mz < p; mz++) {
+                                for (int my = 0; my < p; my++) {
+                                    for (int mx = 0; mx < p; mx++) {
+                                        double value = L[mx + p * (my + p * mz)];
+                                        gx += value * m_leaf_ds[u * p + mx] * m_leaf_s[v * p + my] * m_leaf_s[w * p + mz];
+                                        gy += value * m_leaf_s[u * p + mx] * m_leaf_ds[v * p + my] * m_leaf_s[w * p + mz];
+                                        gz += value * m_leaf_s[u * p + mx] * m_leaf_s[v * p + my] * m_leaf_ds[w * p + mz];
+                                    }
+                                }
+                            }
+                            double fx = -gx / half_width;
+                            double fy = -gy / half_width;
+                            double fz = -gz / half_width;
+
+                            // Near field: every cell of the neighboring leaves
+                            int z0 = std::max(0, (bz - 1) * s), z1 = std::min(m_n, (bz + 2) * s);
+                            int y0 = std::max(0, (by - 1) * s), y1 = std::min(m_n, (by + 2) * s);
+                            int x0 = std::max(0, (bx - 1) * s), x1 = std::min(m_n, (bx + 2) * s);
+                            for (int jz = z0; jz < z1; jz++) {
+                                for (int jy = y0; jy < y1; jy++) {
+                                    const double* row = &near[(y - jy + reach) * span + (z - jz + reach) * span * span + reach + x];
+                                    const float* src = &source[m_n * (jy + m_n * jz)];
+                                    for (int jx = x0; jx < x1; jx++) {
+                                        double f = row[-jx] * src[jx];
+                                        fx += f * (x - jx);
+                                        fy += f * (y - jy);
+                                        fz += f * (z - jz);
+                                    }
+                                }
+                            }
+
+                            double scale = target ? coupling * target[i] : coupling;
+                            F.set(i, (float)(fx * scale), (float)(fy * scale), (float)(fz * scale));
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
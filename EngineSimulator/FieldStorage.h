@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+const size_t field_alignment = 64; // Cache line size, also the width of an AVX-512 register
+
+inline void* aligned_allocate(size_t bytes) {
+    void* data = nullptr;
+#ifdef _WIN32
+    data = _aligned_malloc(bytes, field_alignment);
+#else
+    if (posix_memalign(&data, field_alignment, bytes) != 0) {
+        data = nullptr;
+    }
+#endif
+    if (!data) {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+inline void aligned_free(void* data) {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+// Heap array of a plain element type whose first element starts on a field_alignment boundary.
+// Converts to a pointer so fields keep the indexing and call syntax of the fixed arrays they replace.
+template <typename T>
+class AlignedArray {
+    static_assert(std::is_trivial<T>::value, "AlignedArray only holds plain data");
+
+public:
+    AlignedArray() :
+        m_data(nullptr),
+        m_size(0)
+    {
+    }
+
+    explicit AlignedArray(size_t size) :
+        m_data(nullptr),
+        m_size(0)
+    {
+        resize(size);
+    }
+
+    AlignedArray(AlignedArray&& other) :
+        m_data(other.m_data),
+        m_size(other.m_size)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    AlignedArray& operator=(AlignedArray&& other) {
+        if (this != &other) {
+            aligned_free(m_data);
+            m_data = other.m_data;
+            m_size = other.m_size;
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+        return *this;
+    }
+
+    AlignedArray(const AlignedArray&) = delete;
+    AlignedArray& operator=(const AlignedArray&) = delete;
+
+    ~AlignedArray() {
+        aligned_free(m_data);
+    }
+
+    // Reallocate for size elements, all set to zero
+    void resize(size_t size) {
+        aligned_free(m_data);
+        m_data = nullptr;
+        m_size = 0;
+
+        if (size > 0) {
+            m_data = static_cast<T*>(aligned_allocate(size * sizeof(T)));
+            m_size = size;
+            memset(m_data, 0, size * sizeof(T));
+        }
+    }
+
+    size_t size() const { return m_size; }
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
+    operator T*() { return m_data; }
+    operator const T*() const { return m_data; }
+
+private:
+    T* m_data;
+    size_t m_size;
+};
+
+typedef AlignedArray<float> ScalarField;
+
+// Three-component cell field stored as separate x, y and z streams (structure of arrays), so a pass over one
+// component reads contiguous memory and loads whole vector registers instead of striding over the others.
+class VectorField {
+public:
+    VectorField() {}
+
+    explicit VectorField(size_t size) {
+        resize(size);
+    }
+
+    // Reallocate every component for size cells, all set to zero
+    void resize(size_t size) {
+        x.resize(size);
+        y.resize(size);
+        z.resize(size);
+    }
+
+    size_t size() const { return x.size(); }
+
+    // Stream of component c, 0 for x, 1 for y and 2 for z
+    float* component(int c) { return c == 0 ? x.data() : c == 1 ? y.data() : z.data(); }
+    const float* component(int c) const { return c == 0 ? x.data() : c == 1 ? y.data() : z.data(); }
+
+    void set(size_t i, float fx, float fy, float fz) {
+        x[i] = fx;
+        y[i] = fy;
+        z[i] = fz;
+    }
+
+    void add(size_t i, float fx, float fy, float fz) {
+        x[i] += fx;
+        y[i] += fy;
+        z[i] += fz;
+    }
+
+    void scale(size_t i, float factor) {
+        x[i] *= factor;
+        y[i] *= factor;
+        z[i] *= factor;
+    }
+
+    void fill_zero() {
+        memset(x.data(), 0, x.size() * sizeof(float));
+        memset(y.data(), 0, y.size() * sizeof(float));
+        memset(z.data(), 0, z.size() * sizeof(float));
+    }
+
+    ScalarField x;
+    ScalarField y;
+    ScalarField z;
+};
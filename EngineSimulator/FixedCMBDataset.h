@@ -0,0 +1,137 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "CMBDataset.h"
+#include "ForceKernels.h"
+#include "KernelTable.h"
+
+// Smallest whole number of cells not less than v, usable in constant expressions
+constexpr int cells_spanned(float v) {
+    return (float)(int)v < v ? (int)v + 1 : (int)v;
+}
+
+// Offsets with 0 < r < radius cells that come after the zero offset in z, y, x order: one of every +/- pair,
+// so a loop over them visits each unordered pair of cells once. Offsets that cannot pair two cells of an
+// extent-wide grid are left out. Built at compile time.
+template <int Reach>
+struct HalfStencil {
+    static constexpr int capacity = ((2 * Reach + 1) * (2 * Reach + 1) * (2 * Reach + 1) - 1) / 2;
+
+    StencilOffset offsets[capacity];
+    int count;
+
+    constexpr HalfStencil(float radius, int extent) :
+        offsets{},
+        count(0)
+    {
+        for (int dk = 0; dk <= Reach; dk++) {
+            for (int dj = -Reach; dj <= Reach; dj++) {
+                for (int di = -Reach; di <= Reach; di++) {
+                    bool first = dk > 0 || (dk == 0 && (dj > 0 || (dj == 0 && di > 0)));
+                    bool inside = di < extent && -di < extent && dj < extent && -dj < extent && dk < extent;
+                    if (first && inside && (float)(di * di + dj * dj + dk * dk) < radius * radius) {
+                        offsets[count].di = di;
+                        offsets[count].dj = dj;
+                        offsets[count].dk = dk;
+                        count++;
+                    }
+                }
+            }
+        }
+    }
+};
+
+// CMBDataset specialized at compile time for a production preset: an Extent^3 grid evaluating only the forces
+// in ForceSet. The weak pass runs its row kernel with the grid size and stencil length as constants, and the total
+// force only sums the fields of ForceSet. Both override the passes of CMBDataset, so calculate_forces, multiple
+// time stepping and refresh all use them.
+// The solver choices and thread count stay runtime settings; CMBDataset remains for grids sized at run time.
+template <int Extent, unsigned ForceSet = all_forces>
+class FixedCMBDataset : public CMBDataset {
+    static_assert(Extent > 0, "a grid needs at least one cell");
+    static_assert((ForceSet & ~all_forces) == 0, "unknown force in ForceSet");
+
+public:
+    static constexpr int extent = Extent;
+    static constexpr int cells = Extent * Extent * Extent;
+    static constexpr unsigned forces = ForceSet;
+
+    FixedCMBDataset();
+
+protected:
+    void calculate_weak_nuclear() override;
+    void calculate_total_force() override;
+
+private:
+    static constexpr int weak_reach = cells_spanned(weak_cutoff / h);
+
+    static constexpr HalfStencil<weak_reach> weak_stencil() { return HalfStencil<weak_reach>(weak_cutoff / h, Extent); }
+};
+
+template <int Extent, unsigned ForceSet>
+FixedCMBDataset<Extent, ForceSet>::FixedCMBDataset() :
+    CMBDataset(Extent)
+{
+    m_enabled_forces = ForceSet;
+
+    // The weak table of CMBDataset, rebuilt in the order of the compile-time stencil
+    static constexpr HalfStencil<weak_reach> stencil = weak_stencil();
+    std::shared_ptr<const OffsetKernelTable> weak =
+        kernel_table_cache().table("weak", Extent < weak_reach + 1 ? Extent : weak_reach + 1, h, weak_kernel);
+
+    m_weak_stencil.assign(stencil.offsets, stencil.offsets + stencil.count);
+    m_weak_table.resize(3 * stencil.count);
+    for (int s = 0; s < stencil.count; s++) {
+        const StencilOffset& o = stencil.offsets[s];
+        if (weak) {
+            weak->lookup(o.di, o.dj, o.dk, &m_weak_table[3 * s]);
+        }
+        else {
+            OffsetKernelTable::evaluate(o.di, o.dj, o.dk, h, weak_kernel, &m_weak_table[3 * s]);
+        }
+    }
+}
+
+template <int Extent, unsigned ForceSet>
+void FixedCMBDataset<Extent, ForceSet>::calculate_weak_nuclear() {
+    static constexpr HalfStencil<weak_reach> stencil = weak_stencil();
+
+    weak_charges(cells, electron.T3, q, rho, m_weak_charge);
+    m_weak_scatter.run(Extent, weak_reach, Fw, [&](const CellBox& box, VectorField& out) {
+        weak_stencil_rows(std::integral_constant<int, Extent>(), box, stencil.offsets, m_weak_table.data(),
+            std::integral_constant<int, stencil.count>(), m_weak_charge, out);
+    });
+}
+
+template <int Extent, unsigned ForceSet>
+void FixedCMBDataset<Extent, ForceSet>::calculate_total_force() {
+    for (int c = 0; c < 3; c++) {
+        float* total = Fn.component(c);
+        const float* g = Fg.component(c);
+        const float* e = Fe.component(c);
+        const float* w = Fw.component(c);
+        const float* s = Fs.component(c);
+
+        parallel_for(0, cells, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                float f = 0.0f;
+                if (ForceSet & gravity_force) {
+                    f += g[i];
+                }
+                if (ForceSet & electromagnetic_force) {
+                    f += e[i];
+                }
+                if (ForceSet & weak_force) {
+                    f += w[i];
+                }
+                if (ForceSet & strong_force) {
+                    f += s[i];
+                }
+                total[i] = f;
+            }
+        });
+    }
+}
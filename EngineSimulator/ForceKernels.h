@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cmath>
+
+#include "CMBDataset.h"
+#include "PairKernels.h"
+#include "WeakCouplings.h"
+
+constexpr float pi = 3.14159265f;
+
+// Total mass of the reference sphere that scales the gravitational pull of each cell
+constexpr float M_sphere = 4.0f / 3.0f * pi * R * R * R * rho0;
+
+// Magnitude of the gravitational force per unit source density at distance r
+inline float gravity_kernel(float r) {
+    float a = 1.0f + H * r - 0.5f * H * H * r * r; // Acceleration rate/inflation
+    return G * M_sphere / r / r * a;
+}
+
+// Potential whose negative gradient gives gravity_kernel, so Fg = -grad(sum of rho[j] * gravity_potential(r))
+inline float gravity_potential(float r) {
+    return G * M_sphere * (1.0f / r - H * log(r) + 0.5f * H * H * r);
+}
+
+// gravity_kernel(r) / r as a polynomial in 1/r, the form PairForceSolver evaluates
+inline RadialPolynomial gravity_radial() {
+    RadialPolynomial radial = { G * M_sphere, G * M_sphere * H, -0.5f * G * M_sphere * H * H };
+    return radial;
+}
+
+// Magnitude of the inverse-square force between unit charges
+inline float inverse_square_kernel(float r) {
+    return 1.0f / r / r;
+}
+
+// 1 / r^3, the inverse-square force divided by r with the coupling left to the solver
+inline RadialPolynomial inverse_square_radial() {
+    RadialPolynomial radial = { 1.0f, 0.0f, 0.0f };
+    return radial;
+}
+
+constexpr float k_e = 8.9875517923e9f; // Coulomb constant
+constexpr float alpha_s = 0.118f; // Strong coupling constant
+constexpr float G_F = 1.1663787e-5f; // Fermi coupling constant
+constexpr float lambda_w = h; // Range of Z exchange on the lattice
+constexpr float weak_cutoff = 6.0f * lambda_w; // Past this the Yukawa factor has fallen below 1e-3 of its value at one cell
+
+// Magnitude of the Yukawa force of Z exchange between unit weak charges at distance r
+inline float weak_kernel(float r) {
+    return G_F * exp(-r / lambda_w) * (1.0f + r / lambda_w) / r / r;
+}
+
+// Pairwise kernels as functions of the integer offset (di, dj, dk) from the source cell to the target cell,
+// in the form GridConvolution expects. A cell never acts on itself, so the zero offset gives zero.
+
+// Gravity on a cell per unit density of the source cell
+inline void gravity_offset_kernel(int di, int dj, int dk, float h, double* value) {
+    float dx = di * h;
+    float dy = dj * h;
+    float dz = dk * h;
+    float r = sqrt(dx * dx + dy * dy + dz * dz);
+    float Fg_ij = r > 0.0f ? gravity_kernel(r) : 0.0f;
+
+    value[0] = r > 0.0f ? Fg_ij * dx / r : 0.0f;
+    value[1] = r > 0.0f ? Fg_ij * dy / r : 0.0f;
+    value[2] = r > 0.0f ? Fg_ij * dz / r : 0.0f;
+}
+
+// Inverse-square force per unit charge of both cells, scaled by the coupling of the interaction
+inline void inverse_square_offset_kernel(int di, int dj, int dk, float h, float coupling, double* value) {
+    float dx = di * h;
+    float dy = dj * h;
+    float dz = dk * h;
+    float r = sqrt(dx * dx + dy * dy + dz * dz);
+    float F_ij = r > 0.0f ? coupling / r / r : 0.0f;
+
+    value[0] = r > 0.0f ? F_ij * dx / r : 0.0f;
+    value[1] = r > 0.0f ? F_ij * dy / r : 0.0f;
+    value[2] = r > 0.0f ? F_ij * dz / r : 0.0f;
+}
+
+// Weak force per unit weak charge of both cells
+inline void weak_offset_kernel(int di, int dj, int dk, float h, double* value) {
+    float dx = di * h;
+    float dy = dj * h;
+    float dz = dk * h;
+    float r = sqrt(dx * dx + dy * dy + dz * dz);
+    float Fw_ij = r > 0.0f ? weak_kernel(r) : 0.0f;
+
+    value[0] = r > 0.0f ? Fw_ij * dx / r : 0.0f;
+    value[1] = r > 0.0f ? Fw_ij * dy / r : 0.0f;
+    value[2] = r > 0.0f ? Fw_ij * dz / r : 0.0f;
+}
@@ -0,0 +1,98 @@
+#include "GridConvolution.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+GridConvolution::GridConvolution() :
+    m_n(0),
+    m_mesh(0),
+    m_components(0)
+{
+}
+
+bool GridConvolution::prepared(int n) const {
+    return m_fft && m_n == n;
+}
+
+void GridConvolution::prepare(int n, int components, const Kernel& kernel) {
+    m_n = n;
+    m_components = components;
+
+    // Offsets span [-(n-1), n-1] in each dimension, so a mesh of 2n-1 or more keeps them from wrapping
+    // onto each other; rounding up to a power of two keeps every transform on the radix-2 path
+    m_mesh = next_power_of_two(2 * n - 1);
+    m_fft.reset(new Fft3D<double>(m_mesh, m_mesh, m_mesh));
+    m_source_k.resize(m_fft->complex_size());
+    m_work_k.resize(m_fft->complex_size());
+
+    int mesh_cells = m_fft->real_size();
+    std::vector<double> samples(mesh_cells * components, 0.0);
+    std::vector<double> value(components);
+
+    for (int z = 0; z < m_mesh; z++) {
+        for (int y = 0; y < m_mesh; y++) {
+            for (int x = 0; x < m_mesh; x++) {
+                int di = x < n ? x : x - m_mesh;
+                int dj = y < n ? y : y - m_mesh;
+                int dk = z < n ? z : z - m_mesh;
+
+                // The middle of the mesh is never reached by a real offset
+                if (di <= -n || dj <= -n || dk <= -n) {
+                    continue;
+                }
+
+                kernel(di, dj, dk, value.data());
+                int index = x + m_mesh * (y + m_mesh * z);
+                for (int c = 0; c < components; c++) {
+                    samples[c * mesh_cells + index] = value[c];
+                }
+            }
+        }
+    }
+
+    m_kernel_k.resize(components);
+    m_real.resize(mesh_cells);
+    for (int c = 0; c < components; c++) {
+        m_kernel_k[c].resize(m_fft->complex_size());
+        std::copy(samples.begin() + c * mesh_cells, samples.begin() + (c + 1) * mesh_cells, m_real.begin());
+        m_fft->forward(m_real.data(), m_kernel_k[c].data());
+    }
+}
+
+void GridConvolution::apply(const float* source, float* const* out) {
+    // Place the source in the corner of the zero-padded mesh
+    std::fill(m_real.begin(), m_real.end(), 0.0);
+    parallel_for(0, m_n, [&](int begin, int end) {
+        for (int z = begin; z < end; z++) {
+            for (int y = 0; y < m_n; y++) {
+                for (int x = 0; x < m_n; x++) {
+                    m_real[x + m_mesh * (y + m_mesh * z)] = source[x + m_n * (y + m_n * z)];
+                }
+            }
+        }
+    });
+
+    m_fft->forward(m_real.data(), m_source_k.data());
+
+    for (int c = 0; c < m_components; c++) {
+        const std::vector<Complex>& kernel_k = m_kernel_k[c];
+        parallel_for(0, (int)m_work_k.size(), [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                m_work_k[k] = m_source_k[k] * kernel_k[k];
+            }
+        });
+
+        m_fft->inverse(m_work_k.data(), m_real.data());
+
+        float* component = out[c];
+        parallel_for(0, m_n, [&](int begin, int end) {
+            for (int z = begin; z < end; z++) {
+                for (int y = 0; y < m_n; y++) {
+                    for (int x = 0; x < m_n; x++) {
+                        component[x + m_n * (y + m_n * z)] = (float)m_real[x + m_mesh * (y + m_mesh * z)];
+                    }
+                }
+            }
+        });
+    }
+}
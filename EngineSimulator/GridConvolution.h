@@ -0,0 +1,40 @@
+#pragma once
+
+#include <complex>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "FFT.h"
+
+// Convolution of a cell field with a kernel that only depends on the integer offset between cells.
+// Every pairwise sum over the grid of the form out[i] = sum_j source[j] * K(i - j) can be expressed
+// this way; the kernel is transformed once per grid size and each application is a zero-padded FFT
+// convolution, O(M log M) and equal to the direct sum up to rounding.
+class GridConvolution {
+public:
+    // Writes the kernel components for the offset (di, dj, dk) = cell i - cell j
+    typedef std::function<void(int di, int dj, int dk, double* value)> Kernel;
+
+    GridConvolution();
+
+    // Precompute the transform of a kernel with the given number of components for an n*n*n grid
+    void prepare(int n, int components, const Kernel& kernel);
+    bool prepared(int n) const;
+
+    // out[c][i] = sum over j of source[j] * K_c(i - j), one output stream per component
+    void apply(const float* source, float* const* out);
+
+private:
+    typedef std::complex<double> Complex;
+
+    int m_n;
+    int m_mesh;
+    int m_components;
+
+    std::unique_ptr<Fft3D<double> > m_fft;
+    std::vector<std::vector<Complex> > m_kernel_k; // One transformed kernel per component
+    std::vector<Complex> m_source_k;
+    std::vector<Complex> m_work_k;
+    std::vector<double> m_real;
+};
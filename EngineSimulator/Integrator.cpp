@@ -0,0 +1,182 @@
+#include "Integrator.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace {
+    void kick(ParticleStore& particles, float dt) {
+        parallel_for(0, particles.size(), [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                particles.vx[k] += particles.ax[k] * dt;
+                particles.vy[k] += particles.ay[k] * dt;
+                particles.vz[k] += particles.az[k] * dt;
+            }
+        });
+    }
+
+    void drift(ParticleStore& particles, float dt) {
+        parallel_for(0, particles.size(), [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                particles.x[k] += particles.vx[k] * dt;
+                particles.y[k] += particles.vy[k] * dt;
+                particles.z[k] += particles.vz[k] * dt;
+            }
+        });
+    }
+}
+
+ParticleIntegrator::ParticleIntegrator(Integrator scheme) :
+    m_scheme(scheme),
+    m_current(false),
+    m_count(0),
+    m_evaluations(0),
+    m_particle_evaluations(0),
+    m_depth(0),
+    m_step_length(0.0f)
+{
+}
+
+void ParticleIntegrator::set_scheme(Integrator scheme) {
+    m_scheme = scheme;
+}
+
+void ParticleIntegrator::set_block_steps(int depth, float step_length) {
+    m_depth = std::max(0, std::min(depth, 20));
+    m_step_length = step_length;
+    m_current = false;
+}
+
+std::vector<int> ParticleIntegrator::bin_counts() const {
+    std::vector<int> counts(m_depth + 1, 0);
+    for (size_t i = 0; i < m_bin.size(); i++) {
+        counts[m_bin[i]]++;
+    }
+    return counts;
+}
+
+void ParticleIntegrator::evaluate(ParticleStore& particles, const Acceleration& accelerate, const int* active, int count) {
+    accelerate(particles, active, count);
+    m_current = true;
+    m_count = particles.size();
+    m_evaluations++;
+    m_particle_evaluations += count;
+}
+
+void ParticleIntegrator::step(ParticleStore& particles, float dt, const Acceleration& accelerate) {
+    if (m_scheme == Integrator::Euler) {
+        evaluate(particles, accelerate, nullptr, particles.size());
+        kick(particles, dt);
+        drift(particles, dt);
+
+        // The positions moved after the evaluation
+        m_current = false;
+        return;
+    }
+
+    if (m_depth > 0) {
+        step_blocks(particles, dt, accelerate);
+        return;
+    }
+
+    if (!m_current || m_count != particles.size()) {
+        evaluate(particles, accelerate, nullptr, particles.size());
+    }
+    kick(particles, 0.5f * dt);
+    drift(particles, dt);
+    evaluate(particles, accelerate, nullptr, particles.size());
+    kick(particles, 0.5f * dt);
+}
+
+int ParticleIntegrator::bin_for(const ParticleStore& particles, int k, float dt) const {
+    float a = sqrt(particles.ax[k] * particles.ax[k] + particles.ay[k] * particles.ay[k] + particles.az[k] * particles.az[k]);
+    if (a <= 0.0f) {
+        return 0;
+    }
+
+    // Smallest bin whose step dt / 2^bin is within the particle's own sqrt(2 step_length / a)
+    float ratio = dt / sqrt(2.0f * m_step_length / a);
+    int bin = ratio > 1.0f ? (int)ceil(log2(ratio)) : 0;
+    return std::min(m_depth, bin);
+}
+
+void ParticleIntegrator::step_blocks(ParticleStore& particles, float dt, const Acceleration& accelerate) {
+    int count = particles.size();
+    int substeps = 1 << m_depth;
+    float dt_min = dt / substeps;
+
+    // Every particle starts with accelerations at the current positions and the bin they ask for
+    if (!m_current || m_count != count || (int)m_bin.size() != count) {
+        evaluate(particles, accelerate, nullptr, count);
+        m_bin.resize(count);
+        for (int k = 0; k < count; k++) {
+            m_bin[particles.id(k)] = bin_for(particles, k, dt);
+        }
+    }
+
+    for (int s = 0; s < substeps; s++) {
+        // Opening half kick of the particles whose step starts on this substep
+        parallel_for(0, count, [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                int bin = m_bin[particles.id(k)];
+                if (s % (1 << (m_depth - bin)) == 0) {
+                    float half = 0.5f * dt_min * (1 << (m_depth - bin));
+                    particles.vx[k] += particles.ax[k] * half;
+                    particles.vy[k] += particles.ay[k] * half;
+                    particles.vz[k] += particles.az[k] * half;
+                }
+            }
+        });
+
+        drift(particles, dt_min);
+
+        // Particles whose step ends after this substep get their new acceleration and closing half kick
+        m_active.clear();
+        for (int k = 0; k < count; k++) {
+            int bin = m_bin[particles.id(k)];
+            if ((s + 1) % (1 << (m_depth - bin)) == 0) {
+                m_active.push_back(k);
+            }
+        }
+        if (m_active.empty()) {
+            continue;
+        }
+
+        evaluate(particles, accelerate, m_active.data(), (int)m_active.size());
+        parallel_for(0, (int)m_active.size(), [&](int begin, int end) {
+            for (int a = begin; a < end; a++) {
+                int k = m_active[a];
+                int& bin = m_bin[particles.id(k)];
+                float half = 0.5f * dt_min * (1 << (m_depth - bin));
+                particles.vx[k] += particles.ax[k] * half;
+                particles.vy[k] += particles.ay[k] * half;
+                particles.vz[k] += particles.az[k] * half;
+
+                // Shorter steps can start on any substep, longer ones only where the longer step's grid lines up
+                int wanted = bin_for(particles, k, dt);
+                while (wanted < bin && (s + 1) % (1 << (m_depth - wanted)) != 0) {
+                    wanted++;
+                }
+                bin = wanted;
+            }
+        });
+    }
+}
+
+double kinetic_energy(const ParticleStore& particles) {
+    double energy = 0.0;
+    std::mutex mutex;
+    parallel_for(0, particles.size(), [&](int begin, int end) {
+        double sum = 0.0;
+        for (int k = begin; k < end; k++) {
+            double v2 = (double)particles.vx[k] * particles.vx[k] + (double)particles.vy[k] * particles.vy[k] +
+                (double)particles.vz[k] * particles.vz[k];
+            sum += 0.5 * particles.m[k] * v2;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        energy += sum;
+    });
+    return energy;
+}
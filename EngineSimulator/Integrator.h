@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ParticleStore.h"
+
+// Time integration schemes for the particles
+enum class Integrator {
+    Euler,   // Semi-implicit Euler: v += a dt, then x += v dt; first order
+    Leapfrog // Kick-drift-kick: v += a dt / 2, x += v dt, a from the new x, v += a dt / 2; second order and symplectic
+};
+
+// Advances a ParticleStore by one time step.
+// accelerate fills the ax, ay and az buffers of the store for the current positions, for the count slots listed in
+// active or, when active is null, for every particle. Kick-drift-kick needs the acceleration at both ends of a
+// step, and the one at the end of a step is the one at the start of the next, so it is kept in the store and every
+// step after the first evaluates it once, as Euler does. invalidate() drops the kept acceleration when whatever it
+// came from (the force fields) has changed.
+//
+// With block steps, leapfrog splits the step into 2^depth substeps and gives every particle a power-of-two
+// fraction of the step, dt / 2^bin, with bin the smallest that keeps dt / 2^bin below sqrt(2 step_length / |a|).
+// Every particle drifts on every substep, but only those whose own step ends there are accelerated and kicked, so
+// strongly accelerated particles take short steps without forcing them on everyone else.
+class ParticleIntegrator {
+public:
+    typedef std::function<void(ParticleStore& particles, const int* active, int count)> Acceleration;
+
+    explicit ParticleIntegrator(Integrator scheme = Integrator::Euler);
+
+    void set_scheme(Integrator scheme);
+    Integrator scheme() const { return m_scheme; }
+
+    // Deepest bin and the length that sets each particle's step; a depth of 0 gives every particle the full step. Only
+    // leapfrog steps in blocks; Euler always takes the full step
+    void set_block_steps(int depth, float step_length);
+    int block_depth() const { return m_depth; }
+
+    void step(ParticleStore& particles, float dt, const Acceleration& accelerate);
+    void invalidate() { m_current = false; }
+
+    // Calls to accelerate since construction, and the particles they were made for
+    long long evaluations() const { return m_evaluations; }
+    long long particle_evaluations() const { return m_particle_evaluations; }
+
+    // Particles in each bin, from the full step down, as of the last step
+    std::vector<int> bin_counts() const;
+
+private:
+    void evaluate(ParticleStore& particles, const Acceleration& accelerate, const int* active, int count);
+    void step_blocks(ParticleStore& particles, float dt, const Acceleration& accelerate);
+    int bin_for(const ParticleStore& particles, int k, float dt) const;
+
+    Integrator m_scheme;
+    bool m_current;     // Whether the store's accelerations belong to its current positions
+    int m_count;        // Particle count they were evaluated for
+    long long m_evaluations;
+    long long m_particle_evaluations;
+
+    int m_depth;
+    float m_step_length;
+    std::vector<int> m_bin;    // Bin of every particle by id, so it survives reordering
+    std::vector<int> m_active; // Slots starting or ending their step on a substep
+};
+
+// Kinetic energy of the particles, sum of m v^2 / 2
+double kinetic_energy(const ParticleStore& particles);
@@ -0,0 +1,148 @@
+#include "KernelTable.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+
+OffsetKernelTable::OffsetKernelTable(int n, float h, const Magnitude& magnitude) :
+    m_n(n),
+    m_h(h)
+{
+    size_t entries = (size_t)n * n * n;
+    m_x.resize(entries);
+    m_y.resize(entries);
+    m_z.resize(entries);
+
+    parallel_for(0, n, [&](int begin, int end) {
+        for (int dk = begin; dk < end; dk++) {
+            for (int dj = 0; dj < n; dj++) {
+                for (int di = 0; di < n; di++) {
+                    float value[3];
+                    evaluate(di, dj, dk, h, magnitude, value);
+
+                    int index = di + n * (dj + n * dk);
+                    m_x[index] = value[0];
+                    m_y[index] = value[1];
+                    m_z[index] = value[2];
+                }
+            }
+        }
+    });
+}
+
+void OffsetKernelTable::evaluate(int di, int dj, int dk, float h, const Magnitude& magnitude, float* value) {
+    float dx = di * h;
+    float dy = dj * h;
+    float dz = dk * h;
+    float r = sqrt(dx * dx + dy * dy + dz * dz);
+    float F_r = r > 0.0f ? magnitude(r) / r : 0.0f;
+
+    value[0] = F_r * dx;
+    value[1] = F_r * dy;
+    value[2] = F_r * dz;
+}
+
+KernelTableCache::KernelTableCache(size_t memory_budget) :
+    m_memory_budget(memory_budget),
+    m_clock(0)
+{
+}
+
+std::shared_ptr<const OffsetKernelTable> KernelTableCache::table(const std::string& name, int n, float h,
+    const OffsetKernelTable::Magnitude& magnitude) {
+    size_t needed = 3 * (size_t)n * n * n * sizeof(float);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t e = 0; e < m_entries.size(); e++) {
+            if (m_entries[e].name == name && m_entries[e].n == n && m_entries[e].h == h) {
+                m_entries[e].last_use = ++m_clock;
+                return m_entries[e].table;
+            }
+        }
+        if (!make_room(needed)) {
+            return nullptr;
+        }
+    }
+
+    // Built without the lock: the build runs on the thread pool, whose waiting thread may pick up a task that
+    // asks for another table
+    std::shared_ptr<const OffsetKernelTable> built = std::make_shared<OffsetKernelTable>(n, h, magnitude);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t e = 0; e < m_entries.size(); e++) {
+        if (m_entries[e].name == name && m_entries[e].n == n && m_entries[e].h == h) {
+            m_entries[e].last_use = ++m_clock;
+            return m_entries[e].table;
+        }
+    }
+    if (!make_room(needed)) {
+        return built;
+    }
+
+    Entry entry = { name, n, h, built, ++m_clock };
+    m_entries.push_back(entry);
+    return built;
+}
+
+bool KernelTableCache::make_room(size_t bytes) {
+    if (bytes > m_memory_budget) {
+        return false;
+    }
+
+    size_t used = 0;
+    for (size_t e = 0; e < m_entries.size(); e++) {
+        used += m_entries[e].table->bytes();
+    }
+
+    while (used + bytes > m_memory_budget) {
+        // Least recently used table that only the cache still holds
+        int oldest = -1;
+        for (size_t e = 0; e < m_entries.size(); e++) {
+            if (m_entries[e].table.use_count() == 1 && (oldest < 0 || m_entries[e].last_use < m_entries[oldest].last_use)) {
+                oldest = (int)e;
+            }
+        }
+        if (oldest < 0) {
+            return false;
+        }
+
+        used -= m_entries[oldest].table->bytes();
+        m_entries.erase(m_entries.begin() + oldest);
+    }
+
+    return true;
+}
+
+void KernelTableCache::set_memory_budget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_memory_budget = bytes;
+    make_room(0);
+}
+
+size_t KernelTableCache::memory_budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_memory_budget;
+}
+
+size_t KernelTableCache::bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t used = 0;
+    for (size_t e = 0; e < m_entries.size(); e++) {
+        used += m_entries[e].table->bytes();
+    }
+    return used;
+}
+
+int KernelTableCache::table_count() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)m_entries.size();
+}
+
+void KernelTableCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+KernelTableCache& kernel_table_cache() {
+    static KernelTableCache cache;
+    return cache;
+}
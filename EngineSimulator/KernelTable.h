@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "FieldStorage.h"
+
+// Radial pair kernel K(r) * d / r sampled at every integer offset d = (di, dj, dk) * h of an n*n*n grid.
+// Each component is odd in its own coordinate and even in the other two, so only the octant di, dj, dk >= 0 is
+// stored, n^3 entries per component; other offsets take the signs of their coordinates on lookup.
+class OffsetKernelTable {
+public:
+    // Force magnitude at distance r > 0
+    typedef std::function<float(float r)> Magnitude;
+
+    OffsetKernelTable(int n, float h, const Magnitude& magnitude);
+
+    // The kernel at one offset evaluated directly, what the table holds for it
+    static void evaluate(int di, int dj, int dk, float h, const Magnitude& magnitude, float* value);
+
+    int dimension() const { return m_n; }
+    float spacing() const { return m_h; }
+    size_t bytes() const { return 3 * m_x.size() * sizeof(float); }
+
+    // Kernel for the offset (di, dj, dk) = target cell - source cell, |di|, |dj|, |dk| < n; zero at the zero offset
+    void lookup(int di, int dj, int dk, float* value) const {
+        int index = abs(di) + m_n * (abs(dj) + m_n * abs(dk));
+        value[0] = di < 0 ? -m_x[index] : m_x[index];
+        value[1] = dj < 0 ? -m_y[index] : m_y[index];
+        value[2] = dk < 0 ? -m_z[index] : m_z[index];
+    }
+
+private:
+    int m_n;
+    float m_h;
+    ScalarField m_x;
+    ScalarField m_y;
+    ScalarField m_z;
+};
+
+// Offset tables shared by every force routine, built once per kernel and grid size.
+// Memory is bounded: a table that would exceed the budget first evicts the least recently used tables nobody
+// holds any more, and if it still does not fit it is not built and callers evaluate the kernel directly.
+class KernelTableCache {
+public:
+    explicit KernelTableCache(size_t memory_budget = 256u << 20);
+
+    // Table of the named kernel for an n*n*n grid of spacing h, or null when it does not fit the budget
+    std::shared_ptr<const OffsetKernelTable> table(const std::string& name, int n, float h,
+        const OffsetKernelTable::Magnitude& magnitude);
+
+    void set_memory_budget(size_t bytes);
+    size_t memory_budget() const;
+
+    // Memory held by the cached tables
+    size_t bytes() const;
+    int table_count() const;
+
+    void clear();
+
+private:
+    struct Entry {
+        std::string name;
+        int n;
+        float h;
+        std::shared_ptr<const OffsetKernelTable> table;
+        unsigned long long last_use;
+    };
+
+    bool make_room(size_t bytes);
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    size_t m_memory_budget;
+    unsigned long long m_clock;
+};
+
+// Cache used by CMBDataset and the solvers
+KernelTableCache& kernel_table_cache();
@@ -0,0 +1,98 @@
+#include "Neighborhood.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::vector<StencilOffset> neighborhood_stencil(float radius, float h) {
+    std::vector<StencilOffset> stencil;
+    int reach = (int)ceil(radius / h);
+
+    for (int dk = -reach; dk <= reach; dk++) {
+        for (int dj = -reach; dj <= reach; dj++) {
+            for (int di = -reach; di <= reach; di++) {
+                float r = sqrt((float)(di * di + dj * dj + dk * dk)) * h;
+                if (r > 0.0f && r < radius) {
+                    StencilOffset offset = { di, dj, dk };
+                    stencil.push_back(offset);
+                }
+            }
+        }
+    }
+
+    return stencil;
+}
+
+void stencil_sum(int n, const std::vector<StencilOffset>& stencil, const float* source, float* out) {
+    parallel_for(0, n, [&](int begin, int end) {
+        for (int z = begin; z < end; z++) {
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < n; x++) {
+                    float total = 0.0f;
+
+                    for (size_t s = 0; s < stencil.size(); s++) {
+                        int nx = x + stencil[s].di;
+                        int ny = y + stencil[s].dj;
+                        int nz = z + stencil[s].dk;
+                        if (nx < 0 || nx >= n || ny < 0 || ny >= n || nz < 0 || nz >= n) {
+                            continue;
+                        }
+
+                        total += source[nx + n * (ny + n * nz)];
+                    }
+
+                    out[x + n * (y + n * z)] = total;
+                }
+            }
+        }
+    });
+}
+
+SummedVolumeTable::SummedVolumeTable() :
+    m_n(0)
+{
+}
+
+void SummedVolumeTable::build(int n, const float* source) {
+    m_n = n;
+    int side = n + 1;
+    m_table.assign((size_t)side * side * side, 0.0);
+
+    // table(x, y, z) holds the sum over [0, x) x [0, y) x [0, z)
+    for (int z = 1; z <= n; z++) {
+        for (int y = 1; y <= n; y++) {
+            for (int x = 1; x <= n; x++) {
+                size_t index = x + side * (y + (size_t)side * z);
+                m_table[index] = source[(x - 1) + n * ((y - 1) + n * (z - 1))]
+                    + m_table[index - 1] + m_table[index - side] + m_table[index - side * side]
+                    - m_table[index - 1 - side] - m_table[index - 1 - side * side] - m_table[index - side - side * side]
+                    + m_table[index - 1 - side - side * side];
+            }
+        }
+    }
+}
+
+double SummedVolumeTable::box_sum(int x0, int y0, int z0, int x1, int y1, int z1) const {
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    z0 = std::max(z0, 0);
+    x1 = std::min(x1, m_n);
+    y1 = std::min(y1, m_n);
+    z1 = std::min(z1, m_n);
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1) {
+        return 0.0;
+    }
+
+    int side = m_n + 1;
+    size_t plane = (size_t)side * side;
+
+    // Inclusion-exclusion over the eight corners of the box
+    return m_table[x1 + side * y1 + plane * z1] - m_table[x0 + side * y1 + plane * z1]
+        - m_table[x1 + side * y0 + plane * z1] - m_table[x1 + side * y1 + plane * z0]
+        + m_table[x0 + side * y0 + plane * z1] + m_table[x0 + side * y1 + plane * z0]
+        + m_table[x1 + side * y0 + plane * z0] - m_table[x0 + side * y0 + plane * z0];
+}
+
+double SummedVolumeTable::neighborhood_sum(int x, int y, int z, int radius) const {
+    return box_sum(x - radius, y - radius, z - radius, x + radius + 1, y + radius + 1, z + radius + 1);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+// Offset from a cell to one of its neighbors on the lattice
+struct StencilOffset {
+    int di;
+    int dj;
+    int dk;
+};
+
+// Every offset with 0 < r < radius on a lattice of spacing h; r < 2h gives the 26 cells around a cell
+std::vector<StencilOffset> neighborhood_stencil(float radius, float h);
+
+// out[i] = sum of source over the stencil around cell i, skipping neighbors outside the n*n*n grid
+void stencil_sum(int n, const std::vector<StencilOffset>& stencil, const float* source, float* out);
+
+// Summed-volume table of a cell field: the sum over any axis-aligned box of cells in O(1)
+class SummedVolumeTable {
+public:
+    SummedVolumeTable();
+
+    // Build the table for an n*n*n field in O(M)
+    void build(int n, const float* source);
+
+    // Sum over the cells [x0, x1) x [y0, y1) x [z0, z1), clipped to the grid
+    double box_sum(int x0, int y0, int z0, int x1, int y1, int z1) const;
+
+    // Sum over the cube of cells within radius cells of (x, y, z) in each dimension, including the cell itself
+    double neighborhood_sum(int x, int y, int z, int radius) const;
+
+private:
+    int m_n;
+    std::vector<double> m_table; // (n+1)^3 prefix sums with a zero border at index 0
+};
@@ -0,0 +1,563 @@
+#include "PairKernels.h"
+#include "CacheInfo.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PAIR_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics of any instruction set without extra flags; GCC and Clang need them enabled per function
+#if defined(PAIR_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PAIR_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define PAIR_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define PAIR_TARGET_AVX2
+#define PAIR_TARGET_AVX512
+#endif
+
+namespace {
+    const int widest_vector = 16; // Floats per AVX-512 register, the padding unit of the lattice
+
+    typedef void (*PairKernel)(const float* x, const float* y, const float* z, const float* source, int padded,
+        int first, int last, const RadialPolynomial& radial, const float* target, float coupling, VectorField& F);
+
+    // Adds the force of the sources [j0, j1) to the cells [i0, i1) of fx, fy and fz. With reflect, the tiles are
+    // distinct and the opposite force, scaled by the source of i, is added to the cells [j0, j1) as well.
+    typedef void (*TileKernel)(const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, int j0, int j1, bool reflect, const RadialPolynomial& radial, float* fx, float* fy, float* fz);
+
+    void scalar_kernel(const float* x, const float* y, const float* z, const float* source, int padded,
+        int first, int last, const RadialPolynomial& radial, const float* target, float coupling, VectorField& F) {
+        for (int i = first; i < last; i++) {
+            float fx = 0.0f;
+            float fy = 0.0f;
+            float fz = 0.0f;
+
+            for (int j = 0; j < padded; j++) {
+                float dx = x[i] - x[j];
+                float dy = y[i] - y[j];
+                float dz = z[i] - z[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+
+                // The cell itself is the only source at r = 0; the padding has no weight
+                float inv_r = r2 > 0.0f ? 1.0f / sqrt(r2) : 0.0f;
+                float s = source[j] * inv_r * (radial.c1 + inv_r * (radial.c2 + inv_r * radial.c3));
+                fx += s * dx;
+                fy += s * dy;
+                fz += s * dz;
+            }
+
+            float scale = target ? coupling * target[i] : coupling;
+            F.set(i, fx * scale, fy * scale, fz * scale);
+        }
+    }
+
+    void scalar_tile(const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, int j0, int j1, bool reflect, const RadialPolynomial& radial, float* fx, float* fy, float* fz) {
+        for (int i = i0; i < i1; i++) {
+            float sx = 0.0f;
+            float sy = 0.0f;
+            float sz = 0.0f;
+
+            for (int j = j0; j < j1; j++) {
+                float dx = x[i] - x[j];
+                float dy = y[i] - y[j];
+                float dz = z[i] - z[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+
+                float inv_r = r2 > 0.0f ? 1.0f / sqrt(r2) : 0.0f;
+                float w = inv_r * (radial.c1 + inv_r * (radial.c2 + inv_r * radial.c3));
+                sx += source[j] * w * dx;
+                sy += source[j] * w * dy;
+                sz += source[j] * w * dz;
+                if (reflect) {
+                    fx[j] -= source[i] * w * dx;
+                    fy[j] -= source[i] * w * dy;
+                    fz[j] -= source[i] * w * dz;
+                }
+            }
+
+            fx[i] += sx;
+            fy[i] += sy;
+            fz[i] += sz;
+        }
+    }
+
+#ifdef PAIR_KERNELS_X86
+    PAIR_TARGET_AVX2 inline float horizontal_sum(__m256 v) {
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        sum = _mm_hadd_ps(sum, sum);
+        sum = _mm_hadd_ps(sum, sum);
+        return _mm_cvtss_f32(sum);
+    }
+
+    PAIR_TARGET_AVX2 void avx2_kernel(const float* x, const float* y, const float* z, const float* source, int padded,
+        int first, int last, const RadialPolynomial& radial, const float* target, float coupling, VectorField& F) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 three_halves = _mm256_set1_ps(1.5f);
+        const __m256 c1 = _mm256_set1_ps(radial.c1);
+        const __m256 c2 = _mm256_set1_ps(radial.c2);
+        const __m256 c3 = _mm256_set1_ps(radial.c3);
+
+        for (int i = first; i < last; i++) {
+            __m256 xi = _mm256_set1_ps(x[i]);
+            __m256 yi = _mm256_set1_ps(y[i]);
+            __m256 zi = _mm256_set1_ps(z[i]);
+            __m256 fx = zero;
+            __m256 fy = zero;
+            __m256 fz = zero;
+
+            for (int j = 0; j < padded; j += 8) {
+                __m256 dx = _mm256_sub_ps(xi, _mm256_load_ps(x + j));
+                __m256 dy = _mm256_sub_ps(yi, _mm256_load_ps(y + j));
+                __m256 dz = _mm256_sub_ps(zi, _mm256_load_ps(z + j));
+                __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+                // 12-bit rsqrt refined by one Newton step, y * (1.5 - 0.5 * r2 * y^2), then the r = 0 lane cleared
+                __m256 inv_r = _mm256_rsqrt_ps(r2);
+                inv_r = _mm256_mul_ps(inv_r, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv_r, inv_r), three_halves));
+                inv_r = _mm256_and_ps(inv_r, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+
+                __m256 poly = _mm256_fmadd_ps(_mm256_fmadd_ps(c3, inv_r, c2), inv_r, c1);
+                __m256 s = _mm256_mul_ps(_mm256_mul_ps(_mm256_load_ps(source + j), inv_r), poly);
+                fx = _mm256_fmadd_ps(s, dx, fx);
+                fy = _mm256_fmadd_ps(s, dy, fy);
+                fz = _mm256_fmadd_ps(s, dz, fz);
+            }
+
+            float scale = target ? coupling * target[i] : coupling;
+            F.set(i, horizontal_sum(fx) * scale, horizontal_sum(fy) * scale, horizontal_sum(fz) * scale);
+        }
+    }
+
+    PAIR_TARGET_AVX2 void avx2_tile(const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, int j0, int j1, bool reflect, const RadialPolynomial& radial, float* fx, float* fy, float* fz) {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 three_halves = _mm256_set1_ps(1.5f);
+        const __m256 c1 = _mm256_set1_ps(radial.c1);
+        const __m256 c2 = _mm256_set1_ps(radial.c2);
+        const __m256 c3 = _mm256_set1_ps(radial.c3);
+
+        for (int i = i0; i < i1; i++) {
+            __m256 xi = _mm256_set1_ps(x[i]);
+            __m256 yi = _mm256_set1_ps(y[i]);
+            __m256 zi = _mm256_set1_ps(z[i]);
+            __m256 si = _mm256_set1_ps(source[i]);
+            __m256 sx = zero;
+            __m256 sy = zero;
+            __m256 sz = zero;
+
+            for (int j = j0; j < j1; j += 8) {
+                __m256 dx = _mm256_sub_ps(xi, _mm256_load_ps(x + j));
+                __m256 dy = _mm256_sub_ps(yi, _mm256_load_ps(y + j));
+                __m256 dz = _mm256_sub_ps(zi, _mm256_load_ps(z + j));
+                __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dz, dz)));
+
+                __m256 inv_r = _mm256_rsqrt_ps(r2);
+                inv_r = _mm256_mul_ps(inv_r, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv_r, inv_r), three_halves));
+                inv_r = _mm256_and_ps(inv_r, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+
+                __m256 w = _mm256_mul_ps(inv_r, _mm256_fmadd_ps(_mm256_fmadd_ps(c3, inv_r, c2), inv_r, c1));
+                __m256 t = _mm256_mul_ps(_mm256_load_ps(source + j), w);
+                sx = _mm256_fmadd_ps(t, dx, sx);
+                sy = _mm256_fmadd_ps(t, dy, sy);
+                sz = _mm256_fmadd_ps(t, dz, sz);
+                if (reflect) {
+                    __m256 u = _mm256_mul_ps(si, w);
+                    _mm256_store_ps(fx + j, _mm256_fnmadd_ps(u, dx, _mm256_load_ps(fx + j)));
+                    _mm256_store_ps(fy + j, _mm256_fnmadd_ps(u, dy, _mm256_load_ps(fy + j)));
+                    _mm256_store_ps(fz + j, _mm256_fnmadd_ps(u, dz, _mm256_load_ps(fz + j)));
+                }
+            }
+
+            fx[i] += horizontal_sum(sx);
+            fy[i] += horizontal_sum(sy);
+            fz[i] += horizontal_sum(sz);
+        }
+    }
+
+    PAIR_TARGET_AVX512 void avx512_kernel(const float* x, const float* y, const float* z, const float* source, int padded,
+        int first, int last, const RadialPolynomial& radial, const float* target, float coupling, VectorField& F) {
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 three_halves = _mm512_set1_ps(1.5f);
+        const __m512 c1 = _mm512_set1_ps(radial.c1);
+        const __m512 c2 = _mm512_set1_ps(radial.c2);
+        const __m512 c3 = _mm512_set1_ps(radial.c3);
+
+        for (int i = first; i < last; i++) {
+            __m512 xi = _mm512_set1_ps(x[i]);
+            __m512 yi = _mm512_set1_ps(y[i]);
+            __m512 zi = _mm512_set1_ps(z[i]);
+            __m512 fx = zero;
+            __m512 fy = zero;
+            __m512 fz = zero;
+
+            for (int j = 0; j < padded; j += 16) {
+                __m512 dx = _mm512_sub_ps(xi, _mm512_load_ps(x + j));
+                __m512 dy = _mm512_sub_ps(yi, _mm512_load_ps(y + j));
+                __m512 dz = _mm512_sub_ps(zi, _mm512_load_ps(z + j));
+                __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+                // 14-bit rsqrt refined by one Newton step, with the r = 0 lane zeroed by the mask
+                __mmask16 valid = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+                __m512 inv_r = _mm512_rsqrt14_ps(r2);
+                inv_r = _mm512_maskz_mul_ps(valid, inv_r, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv_r, inv_r), three_halves));
+
+                __m512 poly = _mm512_fmadd_ps(_mm512_fmadd_ps(c3, inv_r, c2), inv_r, c1);
+                __m512 s = _mm512_mul_ps(_mm512_mul_ps(_mm512_load_ps(source + j), inv_r), poly);
+                fx = _mm512_fmadd_ps(s, dx, fx);
+                fy = _mm512_fmadd_ps(s, dy, fy);
+                fz = _mm512_fmadd_ps(s, dz, fz);
+            }
+
+            float scale = target ? coupling * target[i] : coupling;
+            F.set(i, _mm512_reduce_add_ps(fx) * scale, _mm512_reduce_add_ps(fy) * scale, _mm512_reduce_add_ps(fz) * scale);
+        }
+    }
+
+    PAIR_TARGET_AVX512 void avx512_tile(const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, int j0, int j1, bool reflect, const RadialPolynomial& radial, float* fx, float* fy, float* fz) {
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 three_halves = _mm512_set1_ps(1.5f);
+        const __m512 c1 = _mm512_set1_ps(radial.c1);
+        const __m512 c2 = _mm512_set1_ps(radial.c2);
+        const __m512 c3 = _mm512_set1_ps(radial.c3);
+
+        for (int i = i0; i < i1; i++) {
+            __m512 xi = _mm512_set1_ps(x[i]);
+            __m512 yi = _mm512_set1_ps(y[i]);
+            __m512 zi = _mm512_set1_ps(z[i]);
+            __m512 si = _mm512_set1_ps(source[i]);
+            __m512 sx = zero;
+            __m512 sy = zero;
+            __m512 sz = zero;
+
+            for (int j = j0; j < j1; j += 16) {
+                __m512 dx = _mm512_sub_ps(xi, _mm512_load_ps(x + j));
+                __m512 dy = _mm512_sub_ps(yi, _mm512_load_ps(y + j));
+                __m512 dz = _mm512_sub_ps(zi, _mm512_load_ps(z + j));
+                __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dz, dz)));
+
+                __mmask16 valid = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+                __m512 inv_r = _mm512_rsqrt14_ps(r2);
+                inv_r = _mm512_maskz_mul_ps(valid, inv_r, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv_r, inv_r), three_halves));
+
+                __m512 w = _mm512_mul_ps(inv_r, _mm512_fmadd_ps(_mm512_fmadd_ps(c3, inv_r, c2), inv_r, c1));
+                __m512 t = _mm512_mul_ps(_mm512_load_ps(source + j), w);
+                sx = _mm512_fmadd_ps(t, dx, sx);
+                sy = _mm512_fmadd_ps(t, dy, sy);
+                sz = _mm512_fmadd_ps(t, dz, sz);
+                if (reflect) {
+                    __m512 u = _mm512_mul_ps(si, w);
+                    _mm512_store_ps(fx + j, _mm512_fnmadd_ps(u, dx, _mm512_load_ps(fx + j)));
+                    _mm512_store_ps(fy + j, _mm512_fnmadd_ps(u, dy, _mm512_load_ps(fy + j)));
+                    _mm512_store_ps(fz + j, _mm512_fnmadd_ps(u, dz, _mm512_load_ps(fz + j)));
+                }
+            }
+
+            fx[i] += _mm512_reduce_add_ps(sx);
+            fy[i] += _mm512_reduce_add_ps(sy);
+            fz[i] += _mm512_reduce_add_ps(sz);
+        }
+    }
+
+    void cpuid(int leaf, int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuidex(info, leaf, subleaf);
+        for (int r = 0; r < 4; r++) {
+            regs[r] = (unsigned int)info[r];
+        }
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // Register state the operating system saves on a context switch (XCR0)
+    unsigned long long enabled_register_state() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int lo;
+        unsigned int hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((unsigned long long)hi << 32) | lo;
+#endif
+    }
+#endif
+
+    SimdLevel& active_level() {
+        static SimdLevel level = detect_simd_level();
+        return level;
+    }
+
+    PairKernel kernel_for(SimdLevel level) {
+#ifdef PAIR_KERNELS_X86
+        if (level == SimdLevel::Avx512) {
+            return avx512_kernel;
+        }
+        if (level == SimdLevel::Avx2) {
+            return avx2_kernel;
+        }
+#endif
+        return scalar_kernel;
+    }
+
+    TileKernel tile_kernel_for(SimdLevel level) {
+#ifdef PAIR_KERNELS_X86
+        if (level == SimdLevel::Avx512) {
+            return avx512_tile;
+        }
+        if (level == SimdLevel::Avx2) {
+            return avx2_tile;
+        }
+#endif
+        return scalar_tile;
+    }
+}
+
+SimdLevel detect_simd_level() {
+#ifdef PAIR_KERNELS_X86
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    unsigned int max_leaf = regs[0];
+    if (max_leaf < 7) {
+        return SimdLevel::Scalar;
+    }
+
+    // AVX needs the OS to save the YMM state (XCR0 bits 1 and 2), AVX-512 also the opmask and ZMM state (bits 5 to 7)
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool fma = (regs[2] & (1u << 12)) != 0;
+    if (!osxsave || !fma) {
+        return SimdLevel::Scalar;
+    }
+    unsigned long long state = enabled_register_state();
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1u << 5)) != 0 && (state & 0x6) == 0x6;
+    bool avx512 = (regs[1] & (1u << 16)) != 0 && (state & 0xe6) == 0xe6;
+    if (avx512) {
+        return SimdLevel::Avx512;
+    }
+    if (avx2) {
+        return SimdLevel::Avx2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel simd_level() {
+    return active_level();
+}
+
+void set_simd_level(SimdLevel level) {
+    SimdLevel detected = detect_simd_level();
+    active_level() = (int)level > (int)detected ? detected : level;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Avx512:
+        return "AVX-512";
+    case SimdLevel::Avx2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+PairTiles default_pair_tiles() {
+    const CacheSizes& caches = cache_sizes();
+
+    // Half of each level is left to everything else; x, y, z and source take 16 bytes per cell, the sums 12 more
+    auto fit = [](size_t bytes, size_t per_cell, int lowest, int highest) {
+        int cells = (int)(bytes / per_cell) / widest_vector * widest_vector;
+        return std::max(lowest, std::min(highest, cells));
+    };
+
+    PairTiles tiles;
+    tiles.source = fit(caches.l1 / 2, 16, 256, 8192);
+    tiles.target = fit(caches.l2 / 2, 28, 256, 1 << 16);
+    tiles.symmetric = fit(caches.l1, 2 * 28, 128, 4096);
+    return tiles;
+}
+
+PairForceSolver::PairForceSolver() :
+    m_traversal(PairTraversal::Full),
+    m_tiles(default_pair_tiles()),
+    m_n(0),
+    m_h(0.0f),
+    m_padded(0)
+{
+    m_radial.c3 = 1.0f;
+    m_radial.c2 = 0.0f;
+    m_radial.c1 = 0.0f;
+}
+
+void PairForceSolver::set_kernel(const RadialPolynomial& radial) {
+    m_radial = radial;
+}
+
+void PairForceSolver::set_traversal(PairTraversal traversal) {
+    m_traversal = traversal;
+}
+
+void PairForceSolver::set_tiles(const PairTiles& tiles) {
+    // Tiles start on vector boundaries so the aligned loads stay aligned; sizes are rounded up to whole vectors
+    auto round = [](int cells) {
+        return std::max(widest_vector, (cells + widest_vector - 1) / widest_vector * widest_vector);
+    };
+
+    m_tiles.target = round(tiles.target);
+    m_tiles.source = round(tiles.source);
+    m_tiles.symmetric = round(tiles.symmetric);
+}
+
+void PairForceSolver::plan(int n, float h) {
+    m_n = n;
+    m_h = h;
+    int cells = n * n * n;
+    m_padded = (cells + widest_vector - 1) / widest_vector * widest_vector;
+
+    // Padding sits at the origin with zero weight, so it adds nothing whichever cell it is paired with
+    m_x.resize(m_padded);
+    m_y.resize(m_padded);
+    m_z.resize(m_padded);
+    m_source.resize(m_padded);
+    for (int i = 0; i < cells; i++) {
+        m_x[i] = (i % n) * h;
+        m_y[i] = ((i / n) % n) * h;
+        m_z[i] = (i / (n * n)) * h;
+    }
+}
+
+void PairForceSolver::compute(int n, float h, const float* source, const float* target, float coupling, VectorField& F) {
+    if (n != m_n || h != m_h) {
+        plan(n, h);
+    }
+
+    int cells = n * n * n;
+    for (int i = 0; i < cells; i++) {
+        m_source[i] = source[i];
+    }
+
+    if ((m_traversal == PairTraversal::Symmetric || m_padded > m_tiles.source) && (int)m_fx.size() != m_padded) {
+        m_fx.resize(m_padded);
+        m_fy.resize(m_padded);
+        m_fz.resize(m_padded);
+    }
+
+    if (m_traversal == PairTraversal::Symmetric) {
+        compute_symmetric();
+
+        parallel_for(0, cells, [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                float scale = target ? coupling * target[i] : coupling;
+                F.set(i, m_fx[i] * scale, m_fy[i] * scale, m_fz[i] * scale);
+            }
+        });
+        return;
+    }
+
+    // Sources beyond one tile no longer stay in cache while a row sums them, so they are summed tile by tile
+    if (m_padded > m_tiles.source) {
+        compute_tiled(target, coupling, F);
+        return;
+    }
+
+    // Every target row is independent, so rows are spread over the thread pool
+    PairKernel kernel = kernel_for(active_level());
+    parallel_for(0, cells, [&](int begin, int end) {
+        kernel(m_x, m_y, m_z, m_source, m_padded, begin, end, m_radial, target, coupling, F);
+    });
+}
+
+void PairForceSolver::compute_tiled(const float* target, float coupling, VectorField& F) {
+    TileKernel kernel = tile_kernel_for(active_level());
+    int cells = m_n * m_n * m_n;
+
+    // Target tiles are independent and run in parallel, so they are also cut small enough to give every thread a
+    // few; each walks the source tiles in order, and every source tile is summed into all of its targets while it
+    // sits in L1
+    int per_thread = (cells + 4 * default_thread_pool().thread_count() - 1) / (4 * default_thread_pool().thread_count());
+    int target_tile = std::min(m_tiles.target, (per_thread + widest_vector - 1) / widest_vector * widest_vector);
+    int source_tile = m_tiles.source;
+    int target_tiles = (cells + target_tile - 1) / target_tile;
+    parallel_for(0, target_tiles, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            int i0 = t * target_tile;
+            int i1 = std::min(cells, i0 + target_tile);
+            std::fill(m_fx + i0, m_fx + i1, 0.0f);
+            std::fill(m_fy + i0, m_fy + i1, 0.0f);
+            std::fill(m_fz + i0, m_fz + i1, 0.0f);
+            for (int j0 = 0; j0 < m_padded; j0 += source_tile) {
+                kernel(m_x, m_y, m_z, m_source, i0, i1, j0, std::min(m_padded, j0 + source_tile), false, m_radial, m_fx, m_fy, m_fz);
+            }
+
+            for (int i = i0; i < i1; i++) {
+                float scale = target ? coupling * target[i] : coupling;
+                F.set(i, m_fx[i] * scale, m_fy[i] * scale, m_fz[i] * scale);
+            }
+        }
+    }, 1);
+}
+
+void PairForceSolver::compute_symmetric() {
+    TileKernel kernel = tile_kernel_for(active_level());
+    int pair_tile = m_tiles.symmetric;
+    int tiles = (m_padded + pair_tile - 1) / pair_tile;
+
+    // A tile against itself sums every pair in both orders without reflecting, which also clears the tile first
+    parallel_for(0, tiles, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            int first = t * pair_tile;
+            int last = std::min(m_padded, first + pair_tile);
+            std::fill(m_fx + first, m_fx + last, 0.0f);
+            std::fill(m_fy + first, m_fy + last, 0.0f);
+            std::fill(m_fz + first, m_fz + last, 0.0f);
+            kernel(m_x, m_y, m_z, m_source, first, last, first, last, false, m_radial, m_fx, m_fy, m_fz);
+        }
+    }, 1);
+
+    // Distinct tiles by the circle method: every round pairs each tile with one other, so the tile pairs of a round
+    // write disjoint cells and run in parallel. An odd tile count gets a dummy tile that sits the round out.
+    int slots = tiles + (tiles & 1);
+    std::vector<int> first_tile(slots / 2);
+    std::vector<int> second_tile(slots / 2);
+    for (int round = 0; round + 1 < slots; round++) {
+        int pairs = 0;
+        for (int k = 0; k < slots / 2; k++) {
+            int a = k == 0 ? slots - 1 : (round + k) % (slots - 1);
+            int b = (round - k + slots - 1) % (slots - 1);
+            if (a < tiles && b < tiles) {
+                first_tile[pairs] = a;
+                second_tile[pairs] = b;
+                pairs++;
+            }
+        }
+
+        parallel_for(0, pairs, [&](int begin, int end) {
+            for (int p = begin; p < end; p++) {
+                int i0 = first_tile[p] * pair_tile;
+                int j0 = second_tile[p] * pair_tile;
+                kernel(m_x, m_y, m_z, m_source, i0, std::min(m_padded, i0 + pair_tile),
+                    j0, std::min(m_padded, j0 + pair_tile), true, m_radial, m_fx, m_fy, m_fz);
+            }
+        }, 1);
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "FieldStorage.h"
+
+// Instruction sets the pair kernels can run on, from narrowest to widest
+enum class SimdLevel {
+    Scalar, // One source cell at a time, any CPU
+    Avx2,   // 8 source cells per instruction, needs AVX2 and FMA
+    Avx512  // 16 source cells per instruction, needs AVX-512F
+};
+
+// Widest level the CPU and operating system support
+SimdLevel detect_simd_level();
+
+// Level the pair kernels run at, the detected one unless overridden
+SimdLevel simd_level();
+
+// Force a narrower level, e.g. to compare kernels; levels the CPU lacks are clamped to the detected one
+void set_simd_level(SimdLevel level);
+
+const char* simd_level_name(SimdLevel level);
+
+// Pair force magnitude divided by r as a polynomial in 1/r: c3 / r^3 + c2 / r^2 + c1 / r.
+// Multiplying it by the offset (x[i] - x[j]) gives the force vector without a division by r.
+struct RadialPolynomial {
+    float c3;
+    float c2;
+    float c1;
+};
+
+// Order in which PairForceSolver visits the pairs
+enum class PairTraversal {
+    Full,     // Every ordered pair; each target row sums all sources, rows run in parallel
+    Symmetric // Every unordered pair once, adding the force to both cells, so half the pair evaluations
+};
+
+// Cells per tile of the pair traversals, multiples of the widest vector
+struct PairTiles {
+    int target;    // Full traversal: targets whose positions and sums stay in L2 while the source tiles pass by
+    int source;    // Full traversal: sources that stay in L1 while a whole target tile is summed against them
+    int symmetric; // Symmetric traversal: two tiles with their positions, sources and sums fit in L1 together
+};
+
+// Tiles sized from cache_sizes()
+PairTiles default_pair_tiles();
+
+// All-pairs radial force between the cells of an n*n*n grid with vectorized kernels.
+// The lattice coordinates are laid out once per grid, padded to the widest vector, so the inner loop has no
+// integer division, no sqrt or division (1/r comes from rsqrt with one Newton step) and no i == j branch:
+// the r = 0 lane is masked out instead.
+class PairForceSolver {
+public:
+    PairForceSolver();
+
+    void set_kernel(const RadialPolynomial& radial);
+
+    // Symmetric evaluates each pair once as tiles of cells; pairs of tiles are scheduled round-robin so the tiles
+    // in flight at once never share a cell and the reflected writes stay in cache. Full streams every source past
+    // each target while the sources fit in one source tile, and sums source tiles into target tiles beyond that.
+    void set_traversal(PairTraversal traversal);
+    PairTraversal traversal() const { return m_traversal; }
+
+    // F[i] = coupling * target[i] * sum over j != i of source[j] * radial(r) * (x[i] - x[j]), target may be null for 1
+    void compute(int n, float h, const float* source, const float* target, float coupling, VectorField& F);
+
+    // Override the tile sizes, e.g. to compare them, rounded up to multiples of the widest vector; the defaults come
+    // from default_pair_tiles()
+    void set_tiles(const PairTiles& tiles);
+    const PairTiles& tiles() const { return m_tiles; }
+
+private:
+    void plan(int n, float h);
+    void compute_symmetric();
+    void compute_tiled(const float* target, float coupling, VectorField& F);
+
+    RadialPolynomial m_radial;
+    PairTraversal m_traversal;
+    PairTiles m_tiles;
+
+    // Grid the lattice was laid out for
+    int m_n;
+    float m_h;
+    int m_padded; // Cell count rounded up to a whole number of the widest vector
+
+    ScalarField m_x;
+    ScalarField m_y;
+    ScalarField m_z;
+    ScalarField m_source; // Source weights, zero in the padding
+
+    // Unscaled force sums of the symmetric and tiled traversals
+    ScalarField m_fx;
+    ScalarField m_fy;
+    ScalarField m_fz;
+};
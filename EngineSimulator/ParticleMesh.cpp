@@ -0,0 +1,227 @@
+#include "ParticleMesh.h"
+#include "ForceKernels.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ParticleMeshSolver::ParticleMeshSolver(PoissonBoundary boundary, GradientMethod gradient) :
+    m_boundary(boundary),
+    m_gradient(gradient),
+    m_n(0),
+    m_h(0.0f),
+    m_mesh(0),
+    m_planned_boundary(boundary),
+    m_planned_gradient(gradient)
+{
+}
+
+void ParticleMeshSolver::set_boundary(PoissonBoundary boundary) {
+    m_boundary = boundary;
+}
+
+void ParticleMeshSolver::set_gradient(GradientMethod gradient) {
+    m_gradient = gradient;
+}
+
+void ParticleMeshSolver::compute(int n, float h, const float* rho, VectorField& Fg) {
+    // The FFT plan and Green's function only depend on the mesh, so they are kept between steps
+    if (n != m_n || h != m_h || m_boundary != m_planned_boundary || m_gradient != m_planned_gradient || !m_fft) {
+        plan(n, h);
+    }
+
+    transform_density(rho);
+
+    if (samples_force()) {
+        kernel_force(Fg);
+    }
+    else if (m_gradient == GradientMethod::Spectral) {
+        solve_potential();
+        spectral_gradient(Fg);
+    }
+    else {
+        solve_potential();
+        finite_difference_gradient(Fg);
+    }
+}
+
+bool ParticleMeshSolver::samples_force() const {
+    return m_planned_boundary == PoissonBoundary::Isolated && m_planned_gradient == GradientMethod::Spectral;
+}
+
+float ParticleMeshSolver::wavenumber(int k) const {
+    // Frequencies above the Nyquist index wrap around to negative wavenumbers
+    int signed_k = k <= m_mesh / 2 ? k : k - m_mesh;
+    return 2.0f * pi * signed_k / (m_mesh * m_h);
+}
+
+void ParticleMeshSolver::plan(int n, float h) {
+    m_n = n;
+    m_h = h;
+    m_planned_boundary = m_boundary;
+    m_planned_gradient = m_gradient;
+
+    // Isolated boundaries need room for every offset in [-n, n] without wrapping onto another cell
+    m_mesh = m_boundary == PoissonBoundary::Isolated ? 2 * n : n;
+
+    m_fft.reset(new Fft3D<float>(m_mesh, m_mesh, m_mesh));
+    m_phi_k.resize(m_fft->complex_size());
+    m_work_k.resize(m_fft->complex_size());
+    m_mesh_real.resize(m_fft->real_size());
+
+    int cnx = m_fft->complex_nx();
+
+    if (m_boundary == PoissonBoundary::Periodic) {
+        m_green_k.resize(m_fft->complex_size());
+        // Solve laplacian(phi) = -4*pi*G*M*rho/h^3 directly in Fourier space, dropping the mean density
+        float volume = h * h * h;
+        for (int kz = 0; kz < m_mesh; kz++) {
+            for (int ky = 0; ky < m_mesh; ky++) {
+                for (int kx = 0; kx < cnx; kx++) {
+                    float wx = wavenumber(kx);
+                    float wy = wavenumber(ky);
+                    float wz = wavenumber(kz);
+                    float k2 = wx * wx + wy * wy + wz * wz;
+
+                    int index = kx + cnx * (ky + m_mesh * kz);
+                    m_green_k[index] = k2 > 0.0f ? Complex(4.0f * pi * G * M_sphere / (volume * k2), 0.0f) : Complex(0.0f, 0.0f);
+                }
+            }
+        }
+        return;
+    }
+
+    // Sample the real-space kernel at every signed offset, leaving out the cell itself: the force components when
+    // the spectral gradient would only differentiate them back out of the potential, otherwise the potential
+    int kernels = samples_force() ? 3 : 1;
+    for (int c = 0; c < kernels; c++) {
+        for (int z = 0; z < m_mesh; z++) {
+            for (int y = 0; y < m_mesh; y++) {
+                for (int x = 0; x < m_mesh; x++) {
+                    int dx = x <= n ? x : x - m_mesh;
+                    int dy = y <= n ? y : y - m_mesh;
+                    int dz = z <= n ? z : z - m_mesh;
+                    float value;
+                    if (samples_force()) {
+                        double force[3];
+                        gravity_offset_kernel(dx, dy, dz, h, force);
+                        value = (float)force[c];
+                    }
+                    else {
+                        float r = sqrt((float)(dx * dx + dy * dy + dz * dz)) * h;
+                        value = r > 0.0f ? gravity_potential(r) : 0.0f;
+                    }
+                    m_mesh_real[x + m_mesh * (y + m_mesh * z)] = value;
+                }
+            }
+        }
+
+        std::vector<Complex>& kernel = samples_force() ? m_force_k[c] : m_green_k;
+        kernel.resize(m_fft->complex_size());
+        m_fft->forward(m_mesh_real.data(), kernel.data());
+    }
+}
+
+void ParticleMeshSolver::transform_density(const float* rho) {
+    // Scatter the density onto the mesh; the padding region stays empty for isolated boundaries
+    std::fill(m_mesh_real.begin(), m_mesh_real.end(), 0.0f);
+    parallel_for(0, m_n, [&](int begin, int end) {
+        for (int z = begin; z < end; z++) {
+            for (int y = 0; y < m_n; y++) {
+                for (int x = 0; x < m_n; x++) {
+                    m_mesh_real[x + m_mesh * (y + m_mesh * z)] = rho[x + m_n * (y + m_n * z)];
+                }
+            }
+        }
+    });
+
+    m_fft->forward(m_mesh_real.data(), m_phi_k.data());
+}
+
+void ParticleMeshSolver::solve_potential() {
+    parallel_for(0, (int)m_phi_k.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            m_phi_k[k] *= m_green_k[k];
+        }
+    });
+}
+
+void ParticleMeshSolver::spectral_gradient(VectorField& Fg) {
+    int cnx = m_fft->complex_nx();
+
+    for (int axis = 0; axis < 3; axis++) {
+        // Fg = -grad(phi) becomes -ik * phi_k, with the unpaired Nyquist frequency removed
+        parallel_for(0, m_mesh, [&](int begin, int end) {
+            for (int kz = begin; kz < end; kz++) {
+                for (int ky = 0; ky < m_mesh; ky++) {
+                    for (int kx = 0; kx < cnx; kx++) {
+                        int k = axis == 0 ? kx : (axis == 1 ? ky : kz);
+                        float w = (m_mesh % 2 == 0 && k == m_mesh / 2) ? 0.0f : wavenumber(k);
+
+                        int index = kx + cnx * (ky + m_mesh * kz);
+                        m_work_k[index] = Complex(0.0f, -w) * m_phi_k[index];
+                    }
+                }
+            }
+        });
+
+        store_component(axis, Fg);
+    }
+}
+
+void ParticleMeshSolver::kernel_force(VectorField& Fg) {
+    for (int axis = 0; axis < 3; axis++) {
+        const std::vector<Complex>& kernel = m_force_k[axis];
+        parallel_for(0, (int)m_work_k.size(), [&](int begin, int end) {
+            for (int k = begin; k < end; k++) {
+                m_work_k[k] = m_phi_k[k] * kernel[k];
+            }
+        });
+
+        store_component(axis, Fg);
+    }
+}
+
+void ParticleMeshSolver::store_component(int axis, VectorField& Fg) {
+    // Transform m_work_k back and keep the cells of the grid, leaving out any padding
+    m_fft->inverse(m_work_k.data(), m_mesh_real.data());
+
+    float* out = Fg.component(axis);
+    parallel_for(0, m_n, [&](int begin, int end) {
+        for (int z = begin; z < end; z++) {
+            for (int y = 0; y < m_n; y++) {
+                for (int x = 0; x < m_n; x++) {
+                    out[x + m_n * (y + m_n * z)] = m_mesh_real[x + m_mesh * (y + m_mesh * z)];
+                }
+            }
+        }
+    });
+}
+
+void ParticleMeshSolver::finite_difference_gradient(VectorField& Fg) {
+    m_work_k = m_phi_k;
+    m_fft->inverse(m_work_k.data(), m_mesh_real.data());
+
+    // Index -1 wraps to the end of the mesh, which holds the periodic image or the isolated padding value.
+    // One axis at a time so each component stream is written contiguously
+    int stride[3] = { 1, m_mesh, m_mesh * m_mesh };
+    for (int axis = 0; axis < 3; axis++) {
+        float* out = Fg.component(axis);
+
+        parallel_for(0, m_n, [&](int begin, int end) {
+            for (int z = begin; z < end; z++) {
+                for (int y = 0; y < m_n; y++) {
+                    for (int x = 0; x < m_n; x++) {
+                        int c[3] = { x, y, z };
+                        int up = (c[axis] + 1) % m_mesh;
+                        int down = (c[axis] + m_mesh - 1) % m_mesh;
+                        int base = x * stride[0] + y * stride[1] + z * stride[2] - c[axis] * stride[axis];
+
+                        float phi_up = m_mesh_real[base + up * stride[axis]];
+                        float phi_down = m_mesh_real[base + down * stride[axis]];
+                        out[x + m_n * (y + m_n * z)] = -(phi_up - phi_down) / (2.0f * m_h);
+                    }
+                }
+            }
+        });
+    }
+}
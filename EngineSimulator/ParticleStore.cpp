@@ -0,0 +1,188 @@
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+ParticleStore::ParticleStore() :
+    m_n(1),
+    m_h(1.0f),
+    m_interval(16),
+    m_steps(0),
+    m_sorts(0)
+{
+    m_cell_start.assign(2, 0);
+}
+
+void ParticleStore::set_grid(int n, float h) {
+    m_n = n;
+    m_h = h;
+    m_cell_start.assign(n * n * n + 1, 0);
+}
+
+void ParticleStore::resize(int count) {
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    vx.resize(count);
+    vy.resize(count);
+    vz.resize(count);
+    m.resize(count);
+    inv_m.resize(count);
+    ax.resize(count);
+    ay.resize(count);
+    az.resize(count);
+    m_scratch.resize(count);
+
+    m_id.resize(count);
+    m_slot.resize(count);
+    for (int k = 0; k < count; k++) {
+        m_id[k] = k;
+        m_slot[k] = k;
+    }
+    m_steps = 0;
+}
+
+void ParticleStore::set_sort_interval(int steps) {
+    m_interval = steps;
+}
+
+void ParticleStore::update_inverse_mass() {
+    // Massless particles get no acceleration rather than an infinite one
+    parallel_for(0, size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            inv_m[k] = m[k] != 0.0f ? 1.0f / m[k] : 0.0f;
+        }
+    });
+}
+
+bool ParticleStore::step() {
+    m_steps++;
+    if (m_interval <= 0 || m_steps < m_interval) {
+        return false;
+    }
+
+    sort_by_cell();
+    return true;
+}
+
+int ParticleStore::cell_of(int k) const {
+    // Nearest cell center, with particles that left the lattice kept in its boundary cells
+    int cx = std::min(m_n - 1, std::max(0, (int)floor(x[k] / m_h + 0.5f)));
+    int cy = std::min(m_n - 1, std::max(0, (int)floor(y[k] / m_h + 0.5f)));
+    int cz = std::min(m_n - 1, std::max(0, (int)floor(z[k] / m_h + 0.5f)));
+    return cx + m_n * (cy + m_n * cz);
+}
+
+void ParticleStore::permute(ScalarField& attribute) {
+    parallel_for(0, size(), [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            m_scratch[k] = attribute[m_order[k]];
+        }
+    });
+    std::swap(attribute, m_scratch);
+}
+
+void ParticleStore::sort_by_cell() {
+    int count = size();
+    int cells = m_n * m_n * m_n;
+    m_steps = 0;
+    m_sorts++;
+
+    // Every chunk of slots counts its particles per cell over the range of cells it touches. After the first sort
+    // the particles are nearly in cell order, so those ranges barely overlap and the counts take O(cells) memory
+    // however many chunks there are; when they overlap too much (the first sort of scattered particles) the
+    // counting falls back to one chunk.
+    int chunks = std::max(1, std::min(default_thread_pool().thread_count(), count / 1024));
+    int chunk_size = (count + chunks - 1) / std::max(1, chunks);
+    std::vector<int> low(chunks, cells);
+    std::vector<int> high(chunks, -1);
+    m_cell.resize(count);
+    parallel_for(0, chunks, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            for (int k = t * chunk_size; k < std::min(count, (t + 1) * chunk_size); k++) {
+                m_cell[k] = cell_of(k);
+                low[t] = std::min(low[t], m_cell[k]);
+                high[t] = std::max(high[t], m_cell[k]);
+            }
+        }
+    }, 1);
+
+    size_t span = 0;
+    for (int t = 0; t < chunks; t++) {
+        span += high[t] >= low[t] ? high[t] - low[t] + 1 : 0;
+    }
+    if (chunks > 1 && span > 2 * (size_t)cells + count) {
+        chunks = 1;
+        chunk_size = count;
+        low.assign(1, 0);
+        high.assign(1, cells - 1);
+    }
+
+    // Per-chunk counts over each chunk's range, laid end to end
+    std::vector<size_t> base(chunks + 1, 0);
+    for (int t = 0; t < chunks; t++) {
+        base[t + 1] = base[t] + (high[t] >= low[t] ? high[t] - low[t] + 1 : 0);
+    }
+    std::vector<int> counts(base[chunks], 0);
+    parallel_for(0, chunks, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            for (int k = t * chunk_size; k < std::min(count, (t + 1) * chunk_size); k++) {
+                counts[base[t] + m_cell[k] - low[t]]++;
+            }
+        }
+    }, 1);
+
+    // Cell starts from the totals, then each chunk's first slot in every cell: after the chunks before it, which
+    // keeps the sort stable
+    std::fill(m_cell_start.begin(), m_cell_start.end(), 0);
+    for (int t = 0; t < chunks; t++) {
+        for (int c = low[t]; c <= high[t]; c++) {
+            m_cell_start[c + 1] += counts[base[t] + c - low[t]];
+        }
+    }
+    for (int c = 0; c < cells; c++) {
+        m_cell_start[c + 1] += m_cell_start[c];
+    }
+
+    std::vector<int> next(m_cell_start.begin(), m_cell_start.end() - 1);
+    for (int t = 0; t < chunks; t++) {
+        for (int c = low[t]; c <= high[t]; c++) {
+            int& slot = counts[base[t] + c - low[t]];
+            int first = next[c];
+            next[c] += slot;
+            slot = first;
+        }
+    }
+
+    m_order.resize(count);
+    parallel_for(0, chunks, [&](int begin, int end) {
+        for (int t = begin; t < end; t++) {
+            for (int k = t * chunk_size; k < std::min(count, (t + 1) * chunk_size); k++) {
+                m_order[counts[base[t] + m_cell[k] - low[t]]++] = k;
+            }
+        }
+    }, 1);
+
+    permute(x);
+    permute(y);
+    permute(z);
+    permute(vx);
+    permute(vy);
+    permute(vz);
+    permute(m);
+    permute(inv_m);
+    permute(ax);
+    permute(ay);
+    permute(az);
+
+    std::vector<int> id(count);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            id[k] = m_id[m_order[k]];
+            m_slot[id[k]] = k;
+        }
+    });
+    m_id.swap(id);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+#include "FieldStorage.h"
+
+// Particles in structure-of-arrays form, every attribute a separate stream indexed by slot.
+// As particles drift their memory order drifts away from their spatial order, so every sort_interval steps all
+// attributes are reordered by the cell of the n*n*n lattice (cell centers at multiples of h) each particle sits in,
+// with a parallel counting sort. The sort leaves a cell-start table: the particles of cell c are the slots
+// [cell_start(c), cell_start(c + 1)), exactly at the sort and approximately as the particles move on.
+// Slots change at every sort, so particles carry ids: id(k) is the particle in slot k and slot(id) where it is now.
+class ParticleStore {
+public:
+    ParticleStore();
+
+    // Lattice the particles are sorted on
+    void set_grid(int n, float h);
+
+    // Reallocate for count particles, all attributes zero, with ids 0 to count - 1 in slot order
+    void resize(int count);
+    int size() const { return (int)m_id.size(); }
+
+    // Steps between sorts, 0 to never sort on its own
+    void set_sort_interval(int steps);
+    int sort_interval() const { return m_interval; }
+
+    // Count one step and sort once the interval is reached; true when the particles were sorted
+    bool step();
+
+    // Reorder every attribute and id by cell now and rebuild the cell-start table
+    void sort_by_cell();
+
+    // Cell of the lattice containing the particle in slot k at its current position
+    int cell_of(int k) const;
+
+    int cell_start(int c) const { return m_cell_start[c]; }
+    const int* cell_starts() const { return m_cell_start.data(); }
+
+    int id(int k) const { return m_id[k]; }
+    int slot(int id) const { return m_slot[id]; }
+    const int* ids() const { return m_id.data(); }
+
+    // Sorts since construction
+    int sort_count() const { return m_sorts; }
+
+    ScalarField x;
+    ScalarField y;
+    ScalarField z;
+    ScalarField vx;
+    ScalarField vy;
+    ScalarField vz;
+    ScalarField m;
+    ScalarField inv_m; // 1 / m, refreshed by update_inverse_mass whenever m changes
+
+    // Acceleration of every particle as the integrator last evaluated it, kept so the next step can reuse it
+    ScalarField ax;
+    ScalarField ay;
+    ScalarField az;
+
+    void update_inverse_mass();
+
+private:
+    void permute(ScalarField& attribute);
+
+    int m_n;
+    float m_h;
+    int m_interval;
+    int m_steps;
+    int m_sorts;
+
+    std::vector<int> m_cell_start; // n^3 + 1 offsets into the slots
+    std::vector<int> m_id;         // Particle in each slot
+    std::vector<int> m_slot;       // Slot of each particle
+    std::vector<int> m_cell;       // Cell of each slot while sorting
+    std::vector<int> m_order;      // Old slot of each new slot while sorting
+    ScalarField m_scratch;
+};
@@ -0,0 +1,129 @@
+#include "ScatterAccumulator.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ScatterAccumulator::ScatterAccumulator(ScatterSchedule schedule, size_t memory_budget) :
+    m_schedule(schedule),
+    m_last_schedule(schedule),
+    m_memory_budget(memory_budget)
+{
+}
+
+void ScatterAccumulator::set_schedule(ScatterSchedule schedule) {
+    m_schedule = schedule;
+}
+
+ScatterSchedule ScatterAccumulator::schedule() const {
+    return m_schedule;
+}
+
+void ScatterAccumulator::set_memory_budget(size_t bytes) {
+    m_memory_budget = bytes;
+}
+
+size_t ScatterAccumulator::buffer_bytes() const {
+    size_t bytes = 0;
+    for (size_t b = 0; b < m_buffers.size(); b++) {
+        bytes += 3 * m_buffers[b].size() * sizeof(float);
+    }
+    return bytes;
+}
+
+void ScatterAccumulator::run(int n, int reach, VectorField& F, const Kernel& kernel) {
+    ScatterSchedule schedule = m_schedule;
+    if (schedule == ScatterSchedule::Automatic) {
+        // One private copy of F for every thread but the first
+        size_t privatized = (size_t)(default_thread_pool().thread_count() - 1) * 3 * F.size() * sizeof(float);
+        schedule = privatized <= m_memory_budget ? ScatterSchedule::Privatized : ScatterSchedule::Colored;
+    }
+
+    m_last_schedule = schedule;
+    if (schedule == ScatterSchedule::Privatized) {
+        run_privatized(n, F, kernel);
+    }
+    else {
+        m_buffers.clear();
+        run_colored(n, reach, F, kernel);
+    }
+}
+
+void ScatterAccumulator::run_privatized(int n, VectorField& F, const Kernel& kernel) {
+    int cells = (int)F.size();
+    int slabs = std::max(1, std::min(default_thread_pool().thread_count(), n));
+
+    m_buffers.resize(slabs - 1);
+    for (size_t b = 0; b < m_buffers.size(); b++) {
+        if ((int)m_buffers[b].size() != cells) {
+            m_buffers[b].resize(cells);
+        }
+    }
+    std::vector<VectorField*> buffers(slabs);
+    buffers[0] = &F;
+    for (int b = 1; b < slabs; b++) {
+        buffers[b] = &m_buffers[b - 1];
+    }
+
+    // One z slab per thread, each writing only to its own buffer
+    parallel_for(0, slabs, [&](int begin, int end) {
+        for (int b = begin; b < end; b++) {
+            buffers[b]->fill_zero();
+
+            CellBox box = { 0, n, 0, n, b * n / slabs, (b + 1) * n / slabs };
+            kernel(box, *buffers[b]);
+        }
+    }, 1);
+
+    // Pairwise tree reduction, buffer k takes k + stride, so after log2(slabs) rounds F holds the total
+    for (int stride = 1; stride < slabs; stride *= 2) {
+        parallel_for(0, cells, [&](int begin, int end) {
+            for (int k = 0; k + stride < slabs; k += 2 * stride) {
+                VectorField& into = *buffers[k];
+                const VectorField& from = *buffers[k + stride];
+                for (int c = 0; c < 3; c++) {
+                    float* a = into.component(c);
+                    const float* b = from.component(c);
+                    for (int i = begin; i < end; i++) {
+                        a[i] += b[i];
+                    }
+                }
+            }
+        });
+    }
+}
+
+void ScatterAccumulator::run_colored(int n, int reach, VectorField& F, const Kernel& kernel) {
+    int cells = (int)F.size();
+    parallel_for(0, cells, [&](int begin, int end) {
+        for (int c = 0; c < 3; c++) {
+            std::fill(F.component(c) + begin, F.component(c) + end, 0.0f);
+        }
+    });
+
+    // A block writes at most reach cells past its faces, so two blocks of one color, at least one block of
+    // 2 * reach apart in some dimension, never write the same cell. Parity in x, y and z gives 8 colors.
+    int side = std::max(1, 2 * reach);
+    int blocks = (n + side - 1) / side;
+
+    for (int color = 0; color < 8; color++) {
+        std::vector<CellBox> boxes;
+        for (int bz = color >> 2 & 1; bz < blocks; bz += 2) {
+            for (int by = color >> 1 & 1; by < blocks; by += 2) {
+                for (int bx = color & 1; bx < blocks; bx += 2) {
+                    CellBox box = {
+                        bx * side, std::min(n, (bx + 1) * side),
+                        by * side, std::min(n, (by + 1) * side),
+                        bz * side, std::min(n, (bz + 1) * side)
+                    };
+                    boxes.push_back(box);
+                }
+            }
+        }
+
+        parallel_for(0, (int)boxes.size(), [&](int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                kernel(boxes[b], F);
+            }
+        }, 1);
+    }
+}
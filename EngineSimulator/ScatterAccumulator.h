@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "FieldStorage.h"
+
+// Box of cells [x0, x1) x [y0, y1) x [z0, z1) of an n*n*n grid
+struct CellBox {
+    int x0, x1;
+    int y0, y1;
+    int z0, z1;
+};
+
+// How parallel pair loops that also write to the partner cell avoid conflicting writes
+enum class ScatterSchedule {
+    Privatized, // Every thread accumulates into its own copy of the field, then the copies are summed as a tree
+    Colored,    // Blocks of 2 * reach cells are colored so blocks of one color never write to the same cell
+    Automatic   // Privatized while its buffers fit in the memory budget, colored beyond that
+};
+
+// Runs symmetric pair kernels over the grid in parallel without atomics.
+// The kernel visits a box of cells and may add to any cell within reach cells of the box in each dimension,
+// as a Newton's-third-law loop does when it adds F to cell i and -F to cell j. The grid only schedules the work:
+// F may hold one entry per cell or, for bucketed points, one per point, as long as a box only writes to the
+// entries of cells within reach of it.
+class ScatterAccumulator {
+public:
+    typedef std::function<void(const CellBox& box, VectorField& out)> Kernel;
+
+    explicit ScatterAccumulator(ScatterSchedule schedule = ScatterSchedule::Automatic, size_t memory_budget = 256u << 20);
+
+    void set_schedule(ScatterSchedule schedule);
+    ScatterSchedule schedule() const;
+
+    // Most memory the privatized buffers may take before Automatic switches to coloring
+    void set_memory_budget(size_t bytes);
+
+    // F = sum of everything the kernel adds over the whole grid
+    void run(int n, int reach, VectorField& F, const Kernel& kernel);
+
+    // Schedule the last run used and the memory its buffers hold
+    ScatterSchedule last_schedule() const { return m_last_schedule; }
+    size_t buffer_bytes() const;
+
+private:
+    void run_privatized(int n, VectorField& F, const Kernel& kernel);
+    void run_colored(int n, int reach, VectorField& F, const Kernel& kernel);
+
+    ScatterSchedule m_schedule;
+    ScatterSchedule m_last_schedule;
+    size_t m_memory_budget;
+    std::vector<VectorField> m_buffers; // Private copies for every thread but the first, which uses F itself
+};
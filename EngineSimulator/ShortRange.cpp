@@ -0,0 +1,246 @@
+#include "ShortRange.h"
+#include "ThreadPool.h"
+
+#include <cmath>
+#include <vector>
+
+namespace {
+    // Radial kernel with its switching constants
+    struct SwitchedKernel {
+        RadialPolynomial radial;
+        float cutoff2;
+        float on2;
+        float inv_denominator; // 1 / (rc^2 - ron^2)^3
+    };
+
+    // Switched force divided by r for a pair at squared distance 0 < r2 < cutoff2
+    inline float force_over_r(const SwitchedKernel& k, float r2) {
+        float inv_r = 1.0f / sqrt(r2);
+        float w = inv_r * (k.radial.c1 + inv_r * (k.radial.c2 + inv_r * k.radial.c3));
+        if (r2 > k.on2) {
+            // F_s = S F - U dS/dr, the force of the switched potential S U
+            float r = r2 * inv_r;
+            float a = k.cutoff2 - r2;
+            float S = a * a * (k.cutoff2 + 2.0f * r2 - 3.0f * k.on2) * k.inv_denominator;
+            float dS = 12.0f * r * a * (k.on2 - r2) * k.inv_denominator;
+            float U = k.radial.c3 * inv_r - k.radial.c2 * log(r) - k.radial.c1 * r;
+            w = w * S - U * dS * inv_r;
+        }
+        return w;
+    }
+
+    // Adds every pair of the points [i0, i1) with the points [j0, j1); a bucket against itself takes j > i only
+    inline void bucket_pairs(const SwitchedKernel& k, const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, int j0, int j1, bool same, VectorField& out) {
+        for (int i = i0; i < i1; i++) {
+            float fx = 0.0f;
+            float fy = 0.0f;
+            float fz = 0.0f;
+
+            for (int j = same ? i + 1 : j0; j < j1; j++) {
+                float dx = x[i] - x[j];
+                float dy = y[i] - y[j];
+                float dz = z[i] - z[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+                if (r2 >= k.cutoff2 || r2 <= 0.0f) {
+                    continue;
+                }
+
+                float w = force_over_r(k, r2);
+                fx += source[j] * w * dx;
+                fy += source[j] * w * dy;
+                fz += source[j] * w * dz;
+                out.add(j, -source[i] * w * dx, -source[i] * w * dy, -source[i] * w * dz);
+            }
+
+            out.add(i, fx, fy, fz);
+        }
+    }
+
+    // The same for the points [i0, i1) and their listed partners
+    inline void listed_pairs(const SwitchedKernel& k, const float* x, const float* y, const float* z, const float* source,
+        int i0, int i1, const int* start, const int* neighbors, VectorField& out) {
+        for (int i = i0; i < i1; i++) {
+            float fx = 0.0f;
+            float fy = 0.0f;
+            float fz = 0.0f;
+
+            for (int m = start[i]; m < start[i + 1]; m++) {
+                int j = neighbors[m];
+                float dx = x[i] - x[j];
+                float dy = y[i] - y[j];
+                float dz = z[i] - z[j];
+                float r2 = dx * dx + dy * dy + dz * dz;
+                if (r2 >= k.cutoff2 || r2 <= 0.0f) {
+                    continue;
+                }
+
+                float w = force_over_r(k, r2);
+                fx += source[j] * w * dx;
+                fy += source[j] * w * dy;
+                fz += source[j] * w * dz;
+                out.add(j, -source[i] * w * dx, -source[i] * w * dy, -source[i] * w * dz);
+            }
+
+            out.add(i, fx, fy, fz);
+        }
+    }
+}
+
+ShortRangeSolver::ShortRangeSolver() :
+    m_cutoff(1.0f),
+    m_switch_on(1.0f),
+    m_skin(0.0f),
+    m_n(0),
+    m_h(0.0f)
+{
+    m_radial.c3 = 1.0f;
+    m_radial.c2 = 0.0f;
+    m_radial.c1 = 0.0f;
+}
+
+void ShortRangeSolver::set_kernel(const RadialPolynomial& radial) {
+    m_radial = radial;
+}
+
+void ShortRangeSolver::set_cutoff(float cutoff, float switch_on) {
+    m_cutoff = cutoff;
+    m_switch_on = switch_on < cutoff ? switch_on : cutoff;
+    m_verlet.set_range(m_cutoff, m_skin);
+    m_n = 0;
+}
+
+void ShortRangeSolver::set_skin(float skin) {
+    m_skin = skin;
+    m_verlet.set_range(m_cutoff, m_skin);
+}
+
+float ShortRangeSolver::force(float r) const {
+    if (r <= 0.0f || r >= m_cutoff) {
+        return 0.0f;
+    }
+
+    SwitchedKernel k = { m_radial, m_cutoff * m_cutoff, m_switch_on * m_switch_on, 0.0f };
+    if (k.on2 < k.cutoff2) {
+        float d = k.cutoff2 - k.on2;
+        k.inv_denominator = 1.0f / (d * d * d);
+    }
+    return force_over_r(k, r * r) * r;
+}
+
+void ShortRangeSolver::gather(const CellList& cells, const float* x, const float* y, const float* z) {
+    int count = cells.point_count();
+    m_x.resize(count);
+    m_y.resize(count);
+    m_z.resize(count);
+    m_source.resize(count);
+    m_sum.resize(count);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            int i = cells.point(k);
+            m_x[k] = x[i];
+            m_y[k] = y[i];
+            m_z[k] = z[i];
+        }
+    });
+}
+
+void ShortRangeSolver::compute(int count, const float* x, const float* y, const float* z,
+    const float* source, const float* target, float coupling, VectorField& F) {
+    if (m_skin > 0.0f) {
+        // Positions change every call, the list and its bucket order only now and then
+        m_n = 0;
+        m_verlet.update(count, x, y, z);
+        gather(m_verlet.cells(), x, y, z);
+        evaluate(m_verlet.cells(), &m_verlet, source, target, coupling, F);
+        return;
+    }
+
+    m_n = 0;
+    m_cells.build(count, x, y, z, m_cutoff);
+    gather(m_cells, x, y, z);
+    evaluate(m_cells, nullptr, source, target, coupling, F);
+}
+
+void ShortRangeSolver::compute(int n, float h, const float* source, const float* target, float coupling, VectorField& F) {
+    if (n != m_n || h != m_h) {
+        int cells = n * n * n;
+        std::vector<float> x(cells);
+        std::vector<float> y(cells);
+        std::vector<float> z(cells);
+        for (int i = 0; i < cells; i++) {
+            x[i] = (i % n) * h;
+            y[i] = ((i / n) % n) * h;
+            z[i] = (i / (n * n)) * h;
+        }
+
+        m_cells.build(cells, x.data(), y.data(), z.data(), m_cutoff);
+        gather(m_cells, x.data(), y.data(), z.data());
+        m_n = n;
+        m_h = h;
+    }
+
+    evaluate(m_cells, nullptr, source, target, coupling, F);
+}
+
+void ShortRangeSolver::evaluate(const CellList& cells, const VerletList* list, const float* source, const float* target,
+    float coupling, VectorField& F) {
+    int count = cells.point_count();
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            m_source[k] = source[cells.point(k)];
+        }
+    });
+
+    SwitchedKernel k = { m_radial, m_cutoff * m_cutoff, m_switch_on * m_switch_on, 0.0f };
+    if (k.on2 < k.cutoff2) {
+        float d = k.cutoff2 - k.on2;
+        k.inv_denominator = 1.0f / (d * d * d);
+    }
+
+    // Every bucket pairs with itself and the 13 neighbors after it in z, y, x order, so each pair of adjacent
+    // buckets is visited once; writes reach one bucket past the box, which the scatter schedule keeps apart.
+    // A Verlet list holds the same pairs, found on the buckets of its build, so its writes reach no further.
+    static const int forward[13][3] = {
+        { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+        { -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+    };
+    int nb = cells.dimension();
+    m_scatter.run(nb, 1, m_sum, [&](const CellBox& box, VectorField& out) {
+        for (int bz = box.z0; bz < box.z1; bz++) {
+            for (int by = box.y0; by < box.y1; by++) {
+                for (int bx = box.x0; bx < box.x1; bx++) {
+                    int b = cells.bucket(bx, by, bz);
+                    int i0 = cells.start(b);
+                    int i1 = cells.start(b + 1);
+                    if (list) {
+                        listed_pairs(k, m_x, m_y, m_z, m_source, i0, i1, list->starts(), list->neighbors(), out);
+                        continue;
+                    }
+
+                    bucket_pairs(k, m_x, m_y, m_z, m_source, i0, i1, i0, i1, true, out);
+
+                    for (int f = 0; f < 13; f++) {
+                        int nx = bx + forward[f][0];
+                        int ny = by + forward[f][1];
+                        int nz = bz + forward[f][2];
+                        if (nx < 0 || nx >= nb || ny < 0 || ny >= nb || nz >= nb) {
+                            continue;
+                        }
+
+                        int other = cells.bucket(nx, ny, nz);
+                        bucket_pairs(k, m_x, m_y, m_z, m_source, i0, i1, cells.start(other), cells.start(other + 1), false, out);
+                    }
+                }
+            }
+        }
+    });
+
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int s = begin; s < end; s++) {
+            int i = cells.point(s);
+            float scale = target ? coupling * target[i] : coupling;
+            F.set(i, m_sum.x[s] * scale, m_sum.y[s] * scale, m_sum.z[s] * scale);
+        }
+    });
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CellList.h"
+#include "FieldStorage.h"
+#include "PairKernels.h"
+#include "ScatterAccumulator.h"
+#include "VerletList.h"
+
+// Radial pair force cut off at a finite range, with neighbors found through a cell list: O(M * neighbors) instead
+// of all pairs. Each pair within the cutoff is evaluated once and added to both points.
+// Between switch_on and the cutoff the potential is multiplied by the switching function
+// S(r) = (rc^2 - r^2)^2 (rc^2 + 2 r^2 - 3 ron^2) / (rc^2 - ron^2)^3, which takes the potential and the force
+// smoothly to zero, so the energy does not jump when a pair crosses the cutoff.
+// With a skin, points passed to compute are taken to be the same points moving from call to call: their pairs come
+// from a Verlet list that is only rebuilt once some point has moved more than half the skin.
+class ShortRangeSolver {
+public:
+    ShortRangeSolver();
+
+    // Force divided by r as in PairForceSolver; the potential c3 / r - c2 ln(r) - c1 r follows from it
+    void set_kernel(const RadialPolynomial& radial);
+
+    // switch_on >= cutoff gives a hard cutoff
+    void set_cutoff(float cutoff, float switch_on);
+    float cutoff() const { return m_cutoff; }
+    float switch_on() const { return m_switch_on; }
+
+    // Verlet skin for moving points; 0 bins the points afresh on every call
+    void set_skin(float skin);
+    float skin() const { return m_skin; }
+    const VerletList& neighbor_list() const { return m_verlet; }
+
+    // F[i] = coupling * target[i] * sum over j with 0 < r < cutoff of source[j] * S-switched radial(r) * (x[i] - x[j]),
+    // target may be null for 1
+    void compute(int count, const float* x, const float* y, const float* z,
+        const float* source, const float* target, float coupling, VectorField& F);
+
+    // The same for the cells of an n*n*n grid of spacing h, whose cell list is built once
+    void compute(int n, float h, const float* source, const float* target, float coupling, VectorField& F);
+
+    // Switched force magnitude between unit sources at distance r, for checks and plots
+    float force(float r) const;
+
+private:
+    void gather(const CellList& cells, const float* x, const float* y, const float* z);
+    void evaluate(const CellList& cells, const VerletList* list, const float* source, const float* target, float coupling,
+        VectorField& F);
+
+    RadialPolynomial m_radial;
+    float m_cutoff;
+    float m_switch_on;
+    float m_skin;
+
+    // Lattice the cell list was built for, 0 when it holds arbitrary points
+    int m_n;
+    float m_h;
+
+    CellList m_cells; // Buckets of the lattice, or of points binned without a skin
+    VerletList m_verlet;
+    ScalarField m_x; // Positions and sources in bucket order
+    ScalarField m_y;
+    ScalarField m_z;
+    ScalarField m_source;
+    VectorField m_sum; // Unscaled force sums in bucket order
+    ScatterAccumulator m_scatter;
+};
@@ -0,0 +1,51 @@
+#include "TaskGraph.h"
+
+#include <atomic>
+#include <memory>
+
+TaskGraph::Node TaskGraph::add(const std::function<void()>& work) {
+    Task task;
+    task.work = work;
+    task.prerequisites = 0;
+    m_tasks.push_back(task);
+    return (Node)m_tasks.size() - 1;
+}
+
+void TaskGraph::depend(Node node, Node prerequisite) {
+    m_tasks[prerequisite].successors.push_back(node);
+    m_tasks[node].prerequisites++;
+}
+
+void TaskGraph::run(ThreadPool& pool) {
+    int count = size();
+    if (count == 0) {
+        return;
+    }
+
+    // Prerequisites still running for every task; the one that brings it to zero queues the task
+    std::unique_ptr<std::atomic<int>[]> remaining(new std::atomic<int>[count]);
+    for (int t = 0; t < count; t++) {
+        remaining[t] = m_tasks[t].prerequisites;
+    }
+
+    std::atomic<int> pending(count);
+    std::function<void(Node)> launch = [&](Node node) {
+        pool.submit([&, node] {
+            m_tasks[node].work();
+
+            const std::vector<Node>& successors = m_tasks[node].successors;
+            for (size_t s = 0; s < successors.size(); s++) {
+                if (--remaining[successors[s]] == 0) {
+                    launch(successors[s]);
+                }
+            }
+        }, pending);
+    };
+
+    for (int t = 0; t < count; t++) {
+        if (m_tasks[t].prerequisites == 0) {
+            launch(t);
+        }
+    }
+    pool.wait(pending);
+}
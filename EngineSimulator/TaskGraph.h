@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// Directed acyclic graph of tasks executed on a thread pool.
+// A task is queued as soon as every task it depends on has finished, so independent branches run concurrently
+// and tasks may use parallel_for themselves. The graph is kept after run() and can be run again.
+class TaskGraph {
+public:
+    typedef int Node;
+
+    Node add(const std::function<void()>& task);
+
+    // node only starts after prerequisite has finished
+    void depend(Node node, Node prerequisite);
+
+    // Run every task and return once all of them are done
+    void run(ThreadPool& pool);
+
+    int size() const { return (int)m_tasks.size(); }
+
+private:
+    struct Task {
+        std::function<void()> work;
+        std::vector<Node> successors;
+        int prerequisites;
+    };
+
+    std::vector<Task> m_tasks;
+};
@@ -0,0 +1,176 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+    // Pool and queue of the worker running on this thread, so nested submissions stay on the local deque
+    thread_local const ThreadPool* t_pool = nullptr;
+    thread_local int t_queue = -1;
+}
+
+ThreadPool::ThreadPool(int thread_count) :
+    m_queued(0),
+    m_next_queue(0),
+    m_stopping(false)
+{
+    start(thread_count);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::resize(int thread_count) {
+    stop();
+    start(thread_count);
+}
+
+int ThreadPool::thread_count() const {
+    return (int)m_workers.size() + 1;
+}
+
+void ThreadPool::start(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    m_stopping = false;
+    int workers = thread_count - 1;
+    m_queues.clear();
+    for (int q = 0; q <= workers; q++) {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int w = 0; w < workers; w++) {
+        m_workers.push_back(std::thread(&ThreadPool::worker_loop, this, w));
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t w = 0; w < m_workers.size(); w++) {
+        m_workers[w].join();
+    }
+    m_workers.clear();
+}
+
+void ThreadPool::submit(const Task& task, std::atomic<int>& pending) {
+    // Workers keep their own tasks local; other threads spread theirs over every queue
+    int queue = t_pool == this ? t_queue : (int)(m_next_queue++ % m_queues.size());
+
+    Entry entry = { task, &pending };
+    m_queued++;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[queue]->mutex);
+        m_queues[queue]->entries.push_back(entry);
+    }
+
+    // Taking the sleep lock orders this against a worker checking m_queued before it waits
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    }
+    m_wake.notify_one();
+}
+
+bool ThreadPool::pop(int index, Entry& entry) {
+    // Newest task from the own queue first, it is the most likely to be in cache
+    if (index >= 0) {
+        Queue& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.entries.empty()) {
+            entry = own.entries.back();
+            own.entries.pop_back();
+            return true;
+        }
+    }
+
+    // Otherwise steal the oldest task of another queue, which tends to be the largest piece of work left
+    int count = (int)m_queues.size();
+    int first = index >= 0 ? index + 1 : (int)(m_next_queue % count);
+    for (int k = 0; k < count; k++) {
+        Queue& victim = *m_queues[(first + k) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.entries.empty()) {
+            entry = victim.entries.front();
+            victim.entries.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::run_one(int index) {
+    Entry entry;
+    if (!pop(index, entry)) {
+        return false;
+    }
+
+    m_queued--;
+    entry.task();
+    (*entry.pending)--;
+    return true;
+}
+
+void ThreadPool::worker_loop(int index) {
+    t_pool = this;
+    t_queue = index;
+
+    for (;;) {
+        if (run_one(index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [this] { return m_stopping || m_queued > 0; });
+        if (m_stopping && m_queued == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait(std::atomic<int>& pending) {
+    // Outside threads use the spare last queue, so their own submissions are found first
+    int index = t_pool == this ? t_queue : (int)m_queues.size() - 1;
+
+    while (pending > 0) {
+        if (!run_one(index)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int first, int last, const std::function<void(int begin, int end)>& body, int grain) {
+    int count = last - first;
+    if (count <= 0) {
+        return;
+    }
+    if (grain <= 0) {
+        grain = std::max(1, count / (8 * thread_count()));
+    }
+    if (thread_count() == 1 || count <= grain) {
+        body(first, last);
+        return;
+    }
+
+    std::atomic<int> pending(0);
+    for (int begin = first; begin < last; begin += grain) {
+        int end = std::min(last, begin + grain);
+        pending++;
+        submit([&body, begin, end] { body(begin, end); }, pending);
+    }
+    wait(pending);
+}
+
+ThreadPool& default_thread_pool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void parallel_for(int first, int last, const std::function<void(int begin, int end)>& body, int grain) {
+    default_thread_pool().parallel_for(first, last, body, grain);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool of worker threads.
+// Every worker owns a deque: it takes its own tasks from the back and, when it runs dry, steals from the front of
+// the others. A thread waiting for tasks runs queued work itself instead of blocking, so tasks may submit and wait
+// for further tasks (a parallel_for inside a task) without deadlocking. Tasks must not throw.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    // thread_count counts the calling thread, so thread_count - 1 workers are started; 0 uses every hardware thread
+    explicit ThreadPool(int thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Stop the workers and start thread_count - 1 new ones; must not be called while tasks are running
+    void resize(int thread_count);
+    int thread_count() const;
+
+    // Queue a task; pending is decremented once it has run
+    void submit(const Task& task, std::atomic<int>& pending);
+
+    // Run queued tasks on the calling thread until pending reaches zero
+    void wait(std::atomic<int>& pending);
+
+    // Call body(begin, end) on chunks of [first, last) in parallel and return once all of them are done.
+    // grain is the chunk size; 0 picks about eight chunks per thread.
+    void parallel_for(int first, int last, const std::function<void(int begin, int end)>& body, int grain = 0);
+
+private:
+    struct Entry {
+        Task task;
+        std::atomic<int>* pending;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Entry> entries;
+    };
+
+    void start(int thread_count);
+    void stop();
+    void worker_loop(int index);
+    bool run_one(int index);
+    bool pop(int index, Entry& entry);
+
+    std::vector<std::unique_ptr<Queue> > m_queues; // One per worker plus one, the last, for outside threads
+    std::vector<std::thread> m_workers;
+    std::atomic<int> m_queued;
+    std::atomic<unsigned int> m_next_queue;
+
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+};
+
+// Pool shared by every solver and by CMBDataset, created on first use and reused across steps
+ThreadPool& default_thread_pool();
+
+// parallel_for on the default pool
+void parallel_for(int first, int last, const std::function<void(int begin, int end)>& body, int grain = 0);
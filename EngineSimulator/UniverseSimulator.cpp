@@ -1,7 +1,7 @@
 #include "pch.h"
 #include "UniverseSimulator.h"
 
-UniverseSimulator::UniverseSimulator() : m_cmbDataset()
+UniverseSimulator::UniverseSimulator(int gridSize) : m_cmbDataset(gridSize)
 {
 }
 
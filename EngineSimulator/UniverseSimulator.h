@@ -5,7 +5,7 @@
 class UniverseSimulator
 {
 public:
-    UniverseSimulator();
+    explicit UniverseSimulator(int gridSize = N_init);
     ~UniverseSimulator();
 
     void Initialize();
@@ -0,0 +1,131 @@
+#include "VerletList.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+
+namespace {
+    // The bucket itself, then the 13 neighbors after it in z, y, x order, so each pair of adjacent buckets is
+    // visited from one side only
+    const int forward[14][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { -1, 1, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+        { -1, -1, 1 }, { 0, -1, 1 }, { 1, -1, 1 }, { -1, 0, 1 }, { 0, 0, 1 }, { 1, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }
+    };
+}
+
+VerletList::VerletList() :
+    m_cutoff(1.0f),
+    m_skin(0.0f),
+    m_stale(true),
+    m_builds(0)
+{
+    m_start.assign(1, 0);
+}
+
+void VerletList::set_range(float cutoff, float skin) {
+    m_cutoff = cutoff;
+    m_skin = skin;
+    m_stale = true;
+}
+
+bool VerletList::update(int count, const float* x, const float* y, const float* z) {
+    if (!needs_rebuild(count, x, y, z)) {
+        return false;
+    }
+
+    build(count, x, y, z);
+    return true;
+}
+
+bool VerletList::needs_rebuild(int count, const float* x, const float* y, const float* z) const {
+    if (m_stale || count != point_count()) {
+        return true;
+    }
+
+    float limit = 0.25f * m_skin * m_skin;
+    std::atomic<bool> moved(false);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end && !moved.load(std::memory_order_relaxed); k++) {
+            int i = m_cells.point(k);
+            float dx = x[i] - m_x0[k];
+            float dy = y[i] - m_y0[k];
+            float dz = z[i] - m_z0[k];
+            if (dx * dx + dy * dy + dz * dz > limit) {
+                moved.store(true, std::memory_order_relaxed);
+            }
+        }
+    });
+    return moved.load();
+}
+
+void VerletList::build(int count, const float* x, const float* y, const float* z) {
+    float range = m_cutoff + m_skin;
+    m_cells.build(count, x, y, z, range);
+
+    m_x0.resize(count);
+    m_y0.resize(count);
+    m_z0.resize(count);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            int i = m_cells.point(k);
+            m_x0[k] = x[i];
+            m_y0[k] = y[i];
+            m_z0[k] = z[i];
+        }
+    });
+
+    // Two passes over the same search, one counting the neighbors of every point and one writing them into the
+    // slots the prefix sum gives, so both run in parallel without growing shared storage
+    float range2 = range * range;
+    int nb = m_cells.dimension();
+    auto search = [&](int k, int* slot) {
+        int b = m_cells.bucket_of(m_x0[k], m_y0[k], m_z0[k]);
+        int bx = b % nb;
+        int by = (b / nb) % nb;
+        int bz = b / (nb * nb);
+        int found = 0;
+        for (int f = 0; f < 14; f++) {
+            int nx = bx + forward[f][0];
+            int ny = by + forward[f][1];
+            int nz = bz + forward[f][2];
+            if (nx < 0 || nx >= nb || ny < 0 || ny >= nb || nz >= nb) {
+                continue;
+            }
+
+            int other = m_cells.bucket(nx, ny, nz);
+            int l0 = f == 0 ? k + 1 : m_cells.start(other);
+            int l1 = m_cells.start(other + 1);
+            for (int l = l0; l < l1; l++) {
+                float dx = m_x0[k] - m_x0[l];
+                float dy = m_y0[k] - m_y0[l];
+                float dz = m_z0[k] - m_z0[l];
+                if (dx * dx + dy * dy + dz * dz < range2) {
+                    if (slot) {
+                        slot[found] = l;
+                    }
+                    found++;
+                }
+            }
+        }
+        return found;
+    };
+
+    m_start.assign(count + 1, 0);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            m_start[k + 1] = search(k, nullptr);
+        }
+    });
+    for (int k = 0; k < count; k++) {
+        m_start[k + 1] += m_start[k];
+    }
+
+    m_neighbors.resize(m_start[count]);
+    parallel_for(0, count, [&](int begin, int end) {
+        for (int k = begin; k < end; k++) {
+            search(k, m_neighbors.data() + m_start[k]);
+        }
+    });
+
+    m_stale = false;
+    m_builds++;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+#include "CellList.h"
+#include "FieldStorage.h"
+
+// Half neighbor list of moving points in CSR form: every pair closer than cutoff + skin when the list was built
+// appears once, under the point that comes first in bucket order. Points are numbered in the bucket order of the
+// cell list the list was built from, and neighbors of point k are neighbor(m) for m in [start(k), start(k + 1)).
+// As long as no point has moved more than skin / 2 since the build, no pair can have come within the cutoff
+// without being listed, so the list is only rebuilt once some point has.
+class VerletList {
+public:
+    VerletList();
+
+    // Changing the range forces a rebuild on the next update
+    void set_range(float cutoff, float skin);
+    float cutoff() const { return m_cutoff; }
+    float skin() const { return m_skin; }
+
+    // Rebuild if the point count changed or any point moved more than skin / 2; true when the list was rebuilt
+    bool update(int count, const float* x, const float* y, const float* z);
+
+    void build(int count, const float* x, const float* y, const float* z);
+    bool needs_rebuild(int count, const float* x, const float* y, const float* z) const;
+
+    // Buckets the list was built on; neighbors never lie further than one bucket away from their point
+    const CellList& cells() const { return m_cells; }
+
+    int point_count() const { return m_cells.point_count(); }
+    int pair_count() const { return (int)m_neighbors.size(); }
+    int start(int k) const { return m_start[k]; }
+    int neighbor(int m) const { return m_neighbors[m]; }
+    const int* starts() const { return m_start.data(); }
+    const int* neighbors() const { return m_neighbors.data(); }
+
+    // Builds since construction, to see how far the skin stretches them
+    int build_count() const { return m_builds; }
+
+private:
+    float m_cutoff;
+    float m_skin;
+    bool m_stale;
+    int m_builds;
+
+    CellList m_cells;
+    std::vector<int> m_start;     // point_count() + 1 offsets into m_neighbors
+    std::vector<int> m_neighbors; // Bucket-order indices of the listed partners
+    ScalarField m_x0; // Positions at the build, in bucket order
+    ScalarField m_y0;
+    ScalarField m_z0;
+};
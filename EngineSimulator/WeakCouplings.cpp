@@ -0,0 +1,20 @@
+#include "WeakCouplings.h"
+#include "ThreadPool.h"
+
+static_assert(weak_charge(0.5f, 0.0f) > 0.0f, "a neutral isospin +1/2 fermion carries positive weak charge");
+
+void weak_charges(int cells, float T3, const float* q, const float* rho, float* Qw) {
+    const float isospin_term = weak_charge_coupling[0] * T3;
+    const float charge_term = weak_charge_coupling[1];
+
+    parallel_for(0, cells, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Qw[i] = rho[i] > 0.0f ? isospin_term + charge_term * q[i] : 0.0f;
+        }
+    });
+}
+
+void weak_stencil_forces(int n, const CellBox& box, const StencilOffset* stencil, const float* table, int count,
+    const float* Qw, VectorField& out) {
+    weak_stencil_rows(n, box, stencil, table, count, Qw, out);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+
+#include "FieldStorage.h"
+#include "Neighborhood.h"
+#include "ScatterAccumulator.h"
+
+constexpr float sin2_theta_W = 0.231f; // Weak mixing angle
+
+// Weak isospin and electric charge of a fermion, the quantum numbers its weak charge is linear in
+struct QuantumNumbers {
+    float T3;
+    float Q;
+};
+
+constexpr QuantumNumbers electron = { -0.5f, -1.0f };
+
+// Coefficients of T3 and Q in the weak charge Q_w = (1 - 4 sin^2(theta_W)) * (2 T3 - 4 Q sin^2(theta_W)), the
+// source of Z exchange
+constexpr float weak_charge_coupling[2] = {
+    2.0f * (1.0f - 4.0f * sin2_theta_W),
+    -4.0f * sin2_theta_W * (1.0f - 4.0f * sin2_theta_W)
+};
+
+// Weak charge of matter with weak isospin T3 and electric charge Q
+constexpr float weak_charge(float T3, float Q) {
+    return weak_charge_coupling[0] * T3 + weak_charge_coupling[1] * Q;
+}
+
+// Weak charge of every cell whose matter has isospin T3 and the cell's charge q, zero where rho <= 0 so empty
+// cells drop out of the pair products without a branch
+void weak_charges(int cells, float T3, const float* q, const float* rho, float* Qw);
+
+// Adds the force of every pair of a half stencil starting in box to both of its cells, with opposite signs.
+// table holds the force per unit weak charge of each offset. Rows are swept one offset at a time, so the cells
+// of a row and their partners are contiguous and both loops vectorize across pairs.
+void weak_stencil_forces(int n, const CellBox& box, const StencilOffset* stencil, const float* table, int count,
+    const float* Qw, VectorField& out);
+
+// Body of weak_stencil_forces. The grid size and stencil length may be std::integral_constant, which folds the
+// row strides and the loop bounds into the code of a caller that knows them at compile time.
+template <typename Extent, typename Count>
+inline void weak_stencil_rows(Extent n, const CellBox& box, const StencilOffset* stencil, const float* table, Count count,
+    const float* Qw, VectorField& out) {
+    for (int z = box.z0; z < box.z1; z++) {
+        for (int y = box.y0; y < box.y1; y++) {
+            int row = n * (y + n * z);
+
+            for (int s = 0; s < count; s++) {
+                int ny = y + stencil[s].dj;
+                int nz = z + stencil[s].dk;
+                if (ny < 0 || ny >= n || nz < 0 || nz >= n) {
+                    continue;
+                }
+
+                // Cells of the row whose partner x + di is inside the grid
+                int di = stencil[s].di;
+                int x0 = std::max(box.x0, -di);
+                int x1 = std::min(box.x1, n - di);
+                if (x0 >= x1) {
+                    continue;
+                }
+
+                int partner_row = n * (ny + n * nz) + di;
+                const float* Qi = Qw + row;
+                const float* Qj = Qw + partner_row;
+                float kx = table[3 * s];
+                float ky = table[3 * s + 1];
+                float kz = table[3 * s + 2];
+
+                // Partners first, then the cells themselves: along x the two ranges overlap, so one loop writing
+                // both would carry a dependency from one pair to the next
+                float* jx = out.x + partner_row;
+                float* jy = out.y + partner_row;
+                float* jz = out.z + partner_row;
+                for (int x = x0; x < x1; x++) {
+                    float coupling = Qi[x] * Qj[x];
+                    jx[x] += coupling * kx;
+                    jy[x] += coupling * ky;
+                    jz[x] += coupling * kz;
+                }
+
+                float* ix = out.x + row;
+                float* iy = out.y + row;
+                float* iz = out.z + row;
+                for (int x = x0; x < x1; x++) {
+                    float coupling = Qi[x] * Qj[x];
+                    ix[x] -= coupling * kx;
+                    iy[x] -= coupling * ky;
+                    iz[x] -= coupling * kz;
+                }
+            }
+        }
+    }
+}